@@ -1,18 +1,56 @@
 #include <string.h>
 #include <stdio.h>
 #include "mcelog.h"
+#include "memutil.h"
 #include "bitfield.h"
+#include "msg.h"
+#include "record.h"
 
 char *reserved_3bits[8];
 char *reserved_1bit[2];
 char *reserved_2bits[4];
 
-static u64 bitmask(u64 i)
+/* Decoding threads may race here, the first array published wins */
+static unsigned short *field_lens(struct field *f)
 {
-	u64 mask = 1;
-	while (mask < i) 
-		mask = (mask << 1) | 1; 
-	return mask;
+	unsigned short *lens, *old = NULL;
+	unsigned i;
+
+	lens = xalloc(f->stringlen * sizeof(unsigned short));
+	for (i = 0; i < f->stringlen; i++)
+		lens[i] = f->str[i] ? strlen(f->str[i]) : 0;
+	if (!__atomic_compare_exchange_n(&f->lens, &old, lens, 0,
+					 __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+		free(lens);
+		lens = old;
+	}
+	return lens;
+}
+
+/* Format <start_bit:value> for values without a string */
+static int unknown_value(char *buf, unsigned start_bit, u64 v)
+{
+	static const char hex[] = "0123456789abcdef";
+	char tmp[20];
+	int n = 0, k = 0;
+
+	buf[n++] = '<';
+	do {
+		tmp[k++] = '0' + start_bit % 10;
+		start_bit /= 10;
+	} while (start_bit);
+	while (k > 0)
+		buf[n++] = tmp[--k];
+	buf[n++] = ':';
+	do {
+		tmp[k++] = hex[v & 0xf];
+		v >>= 4;
+	} while (v);
+	while (k > 0)
+		buf[n++] = tmp[--k];
+	buf[n++] = '>';
+	buf[n] = 0;
+	return n;
 }
 
 void decode_bitfield(u64 status, struct field *fields)
@@ -24,18 +62,29 @@ void decode_bitfield(u64 status, struct field *fields)
 	int len;
 	
 	for (f = fields; f->str; f++) { 
-		u64 v = (status >> f->start_bit) & bitmask(f->stringlen - 1);
+		u64 v = (status >> f->start_bit) & f->mask;
+		unsigned short *lens = __atomic_load_n(&f->lens, __ATOMIC_ACQUIRE);
 		char *s = NULL;
-		if (v < f->stringlen)
+		if (!lens)
+			lens = field_lens(f);
+		if (v < f->stringlen) {
 			s = f->str[v]; 
+			len = lens[v];
+		}
+		if (record_open) {
+			if (s)
+				record_field(s);
+			else if (v != 0)
+				record_unknown_field(f->start_bit, v);
+		}
+		if (wprintf_quiet)
+			continue;
 		if (!s) { 
 			if (v == 0) 
 				continue;
 			s = buf; 
-			buf[(sizeof buf)-1] = 0;
-			snprintf(buf, (sizeof buf) - 1, "<%u:%llx>", f->start_bit, v);
+			len = unknown_value(buf, f->start_bit, v);
 		}
-		len = strlen(s);
 		if (linelen + len > 75) {
 			delim = "\n";
 			linelen = 0;
@@ -54,6 +103,10 @@ void decode_numfield(u64 status, struct numfield *fields)
 	for (f = fields; f->name; f++) {
 		u64 mask = (1ULL << (f->end - f->start + 1)) - 1;
 		u64 v = (status >> f->start) & mask;
+		if (record_open && (v > 0 || f->force))
+			record_numfield(f->name, v);
+		if (wprintf_quiet)
+			continue;
 		if (v > 0 || f->force) { 
 			char fmt[30];
 			snprintf(fmt, 30, "%%s: %s\n", f->fmt ? f->fmt : "%llu");
@@ -4,6 +4,8 @@ struct field {
 	unsigned start_bit;
 	char **str;
 	unsigned stringlen;
+	u64 mask;		/* covers all indexes into str */
+	unsigned short *lens;	/* string lengths, filled in on first use */
 };
 
 struct numfield { 
@@ -13,8 +15,16 @@ struct numfield {
 	int force;
 };
 
-#define FIELD(start_bit, name) { start_bit, name, NELE(name) }
-#define SBITFIELD(start_bit, string) { start_bit, ((char * [2]) { NULL, string }), 2 }
+/* Smallest all ones mask that is >= x (at least 1), computed at compile time */
+#define SMEAR1(x) ((x) | (x) >> 1)
+#define SMEAR2(x) (SMEAR1(x) | SMEAR1(x) >> 2)
+#define SMEAR4(x) (SMEAR2(x) | SMEAR2(x) >> 4)
+#define SMEAR8(x) (SMEAR4(x) | SMEAR4(x) >> 8)
+#define SMEAR16(x) (SMEAR8(x) | SMEAR8(x) >> 16)
+#define FIELDMASK(n) (SMEAR16((u64)(n) - 1) | 1)
+
+#define FIELD(start_bit, name) { start_bit, name, NELE(name), FIELDMASK(NELE(name)) }
+#define SBITFIELD(start_bit, string) { start_bit, ((char * [2]) { NULL, string }), 2, 1 }
 
 #define NUMBER(start, end, name) { start, end, name, "%llu", 0 }
 #define NUMBERFORCE(start, end, name) { start, end, name, "%llu", 1 }
@@ -74,8 +74,10 @@ static struct field memctrl_mc9[] = {
 	{}
 };
 
-void bdw_de_decode_model(int cputype, int bank, u64 status, u64 misc)
+void bdw_de_decode_model(int cputype, struct mce *m)
 {
+	int bank = m->bank;
+	u64 status = m->status;
 	switch (bank) {
 	case 4:
 		Wprintf("PCU: ");
@@ -1,2 +1,2 @@
-void bdw_epex_decode_model(int cputype, int bank, u64 status, u64 misc);
+void bdw_epex_decode_model(int cputype, struct mce *m);
 int bdw_epex_ce_type(int bank, u64 status, u64 misc);
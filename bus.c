@@ -16,7 +16,6 @@
    on your Linux system. */
 #define _GNU_SOURCE 1
 #include <stdio.h>
-#include <assert.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -28,10 +27,6 @@
 
 static char *bus_trigger, *iomca_trigger;
 
-enum {
-	MAX_ENV = 20,
-};
-
 void bus_setup(void)
 {
 	bus_trigger = config_string("socket", "bus-uc-threshold-trigger");
@@ -52,83 +47,55 @@ void bus_setup(void)
 void run_bus_trigger(int socket, int cpu, char *level, char *pp, char *rrrr,
 		char *ii, char *timeout)
 {
-	int ei = 0;
-	char *env[MAX_ENV];
-	int i;
-	char *msg;
-	char *location;
+	char location[64];
 
 	if (!bus_trigger)
 		return;
 
 	if (socket >= 0)
-		xasprintf(&location, "CPU %d on socket %d", cpu, socket);
+		snprintf(location, sizeof(location), "CPU %d on socket %d", cpu, socket);
 	else
-		xasprintf(&location, "CPU %d", cpu);
-	xasprintf(&msg, "%s received Bus and Interconnect Errors in %s",
-		location, ii);
-	xasprintf(&env[ei++], "LOCATION=%s", location);
-	free(location);
-	location = NULL;
+		snprintf(location, sizeof(location), "CPU %d", cpu);
+	trigger_env_start();
+	trigger_env_add("LOCATION=%s", location);
 
 	if (socket >= 0)
-		xasprintf(&env[ei++], "SOCKETID=%d", socket);
-	xasprintf(&env[ei++], "MESSAGE=%s", msg);
-	xasprintf(&env[ei++], "CPU=%d", cpu);
-	xasprintf(&env[ei++], "LEVEL=%s", level);
-	xasprintf(&env[ei++], "PARTICIPATION=%s", pp);
-	xasprintf(&env[ei++], "REQUEST=%s", rrrr);
-	xasprintf(&env[ei++], "ORIGIN=%s", ii);
-	xasprintf(&env[ei++], "TIMEOUT=%s", timeout);
-	env[ei] = NULL;
-	assert(ei < MAX_ENV);
-
-	run_trigger(bus_trigger, NULL, env, false, "bus");
-	for (i = 0; i < ei; i++) {
-		free(env[i]);
-		env[i] = NULL;
-	}
-	free(msg);
-	msg = NULL;
+		trigger_env_add("SOCKETID=%d", socket);
+	trigger_env_add("MESSAGE=%s received Bus and Interconnect Errors in %s",
+		location, ii);
+	trigger_env_add("CPU=%d", cpu);
+	trigger_env_add("LEVEL=%s", level);
+	trigger_env_add("PARTICIPATION=%s", pp);
+	trigger_env_add("REQUEST=%s", rrrr);
+	trigger_env_add("ORIGIN=%s", ii);
+	trigger_env_add("TIMEOUT=%s", timeout);
+
+	run_trigger(bus_trigger, NULL, trigger_env_finish(), false, "bus");
 }
 
 void run_iomca_trigger(int socket, int cpu, int seg, int bus, int dev, int fn)
 {
-	int ei = 0;
-	char *env[MAX_ENV];
-	int i;
-	char *msg;
-	char *location;
+	char location[64];
 
 	if (!iomca_trigger)
 		return;
 
 	if (socket >= 0)
-		xasprintf(&location, "CPU %d on socket %d", cpu, socket);
+		snprintf(location, sizeof(location), "CPU %d on socket %d", cpu, socket);
 	else
-		xasprintf(&location, "CPU %d", cpu);
-	xasprintf(&msg, "%s received IO MCA Errors from %x:%02x:%02x.%x",
-		location, seg, bus, dev, fn);
-	xasprintf(&env[ei++], "LOCATION=%s", location);
-	free(location);
-	location = NULL;
+		snprintf(location, sizeof(location), "CPU %d", cpu);
+	trigger_env_start();
+	trigger_env_add("LOCATION=%s", location);
 
 	if (socket >= 0)
-		xasprintf(&env[ei++], "SOCKETID=%d", socket);
-	xasprintf(&env[ei++], "MESSAGE=%s", msg);
-	xasprintf(&env[ei++], "CPU=%d", cpu);
-	xasprintf(&env[ei++], "SEG=%x", seg);
-	xasprintf(&env[ei++], "BUS=%02x", bus);
-	xasprintf(&env[ei++], "DEVICE=%02x", dev);
-	xasprintf(&env[ei++], "FUNCTION=%x", fn);
-	env[ei] = NULL;
-	assert(ei < MAX_ENV);
-
-	run_trigger(iomca_trigger, NULL, env, false, "iomca");
-	for (i = 0; i < ei; i++) {
-		free(env[i]);
-		env[i] = NULL;
-	}
-	free(msg);
-	msg = NULL;
+		trigger_env_add("SOCKETID=%d", socket);
+	trigger_env_add("MESSAGE=%s received IO MCA Errors from %x:%02x:%02x.%x",
+		location, seg, bus, dev, fn);
+	trigger_env_add("CPU=%d", cpu);
+	trigger_env_add("SEG=%x", seg);
+	trigger_env_add("BUS=%02x", bus);
+	trigger_env_add("DEVICE=%02x", dev);
+	trigger_env_add("FUNCTION=%x", fn);
+
+	run_trigger(iomca_trigger, NULL, trigger_env_finish(), false, "iomca");
 }
@@ -19,20 +19,21 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
-#include <string.h>
+#include <errno.h>
 #include "mcelog.h"
 #include "client.h"
 #include "paths.h"
 #include "config.h"
+#include "server.h"
+#include "memutil.h"
 
-/* Send a command to the mcelog server and dump output */
-void ask_server(char *command) 
+/* Largest frame payload the client accepts */
+#define MAX_FRAME (1U << 20)
+
+static int connect_server(void)
 {
 	struct sockaddr_un sun;
 	int fd;
-	FILE * fp;
-	int n;
-	char buf[1024];
 	char *path = config_string("server", "socket-path");
 	if (!path)
 		path = SOCKET_PATH;
@@ -40,7 +41,7 @@ void ask_server(char *command)
 	fd = socket(PF_UNIX, SOCK_STREAM, 0);
 	if (fd < 0) {
 		SYSERRprintf("client socket");
-		return;
+		return -1;
 	}
 
 	sun.sun_family = AF_UNIX;
@@ -50,7 +51,20 @@ void ask_server(char *command)
 	if (connect(fd, (struct sockaddr *)&sun, 
 			sizeof(struct sockaddr_un)) < 0)
 		SYSERRprintf("client connect");
-	
+	return fd;
+}
+
+/* Send a command to the mcelog server and dump output */
+void ask_server(char *command) 
+{
+	int fd;
+	FILE * fp;
+	int n;
+	char buf[1024];
+
+	fd = connect_server();
+	if (fd < 0)
+		return;
 	n = strlen(command);
 	if (write(fd, command, n) != n)
 		SYSERRprintf("client command write");
@@ -75,6 +89,134 @@ void ask_server(char *command)
 	SYSERRprintf("client read");
 }
 
+/* Read exactly len bytes, a frame can be split over any number of reads */
+static int read_full(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+
+	while (len > 0) {
+		ssize_t n = read(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static const char *offline_state[] = { "online", "offline", "offline-failed" };
+
+/* Print one frame, returns 1 at the end of the reply */
+static int print_frame(struct mce_frame *h, char *p)
+{
+	struct mce_frame_dimm *d = (struct mce_frame_dimm *)p;
+	struct mce_frame_page *pg = (struct mce_frame_page *)p;
+	uint64_t v;
+	uint32_t version;
+
+	switch (h->type) {
+	case MCE_FRAME_DONE:
+		return 1;
+	case MCE_FRAME_HELLO:
+		memcpy(&version, p, sizeof(version));
+		if (version != MCE_PROTO_VERSION)
+			Eprintf("Server speaks protocol version %u", version);
+		break;
+	case MCE_FRAME_TEXT:
+		fwrite(p, h->len, 1, stdout);
+		break;
+	case MCE_FRAME_ERROR:
+		Eprintf("server: %.*s", (int)h->len, p);
+		break;
+	case MCE_FRAME_GENERATION:
+		memcpy(&v, p, sizeof(v));
+		printf("generation %llu\n", (unsigned long long)v);
+		break;
+	case MCE_FRAME_DIMM:
+		printf("dimm socket %d channel %d dimm %d corrected %u uncorrected %u\n",
+		       d->socketid, d->channel, d->dimm,
+		       d->ce_count, d->uc_count);
+		break;
+	case MCE_FRAME_SOCKET:
+		printf("socket %d corrected %u uncorrected %u\n",
+		       d->socketid, d->ce_count, d->uc_count);
+		break;
+	case MCE_FRAME_PAGE:
+		printf("page %llx count %u %s%s\n",
+		       (unsigned long long)pg->addr, pg->count,
+		       pg->offlined < 3 ? offline_state[pg->offlined] : "?",
+		       pg->triggered ? " triggered" : "");
+		break;
+	case MCE_FRAME_PAGE_REMOVED:
+		memcpy(&v, p, sizeof(v));
+		printf("removed %llx\n", (unsigned long long)v);
+		break;
+	case MCE_FRAME_PAGES_RESET:
+		printf("reset\n");
+		break;
+	default:
+		/* newer frame types are skipped */
+		break;
+	}
+	return 0;
+}
+
+/* Like ask_server, but with binary frames */
+void ask_server_binary(char *command)
+{
+	static const unsigned minlen[] = {
+		[MCE_FRAME_HELLO] = sizeof(uint32_t),
+		[MCE_FRAME_GENERATION] = sizeof(uint64_t),
+		[MCE_FRAME_DIMM] = sizeof(struct mce_frame_dimm),
+		[MCE_FRAME_SOCKET] = sizeof(struct mce_frame_dimm),
+		[MCE_FRAME_PAGE] = sizeof(struct mce_frame_page),
+		[MCE_FRAME_PAGE_REMOVED] = sizeof(uint64_t),
+	};
+	struct mce_frame h;
+	char *buf = NULL, *cmd;
+	unsigned replies = 0;
+	int fd, n;
+
+	fd = connect_server();
+	if (fd < 0)
+		return;
+	n = xasprintf(&cmd, "hello binary %d\n%s", MCE_PROTO_VERSION, command);
+	if (write(fd, cmd, n) != n)
+		SYSERRprintf("client command write");
+	free(cmd);
+
+	/* The hello reply, then one per command line */
+	for (cmd = command; *cmd; cmd++)
+		if (*cmd == '\n')
+			replies++;
+	buf = xalloc(MAX_FRAME);
+	for (replies++; replies > 0; ) {
+		if (read_full(fd, &h, sizeof(h)) < 0)
+			break;
+		if (h.len > MAX_FRAME) {
+			Eprintf("client: oversized frame from server");
+			break;
+		}
+		if (read_full(fd, buf, h.len) < 0)
+			break;
+		if (h.type < sizeof(minlen)/sizeof(*minlen) &&
+		    h.len < minlen[h.type]) {
+			Eprintf("client: short frame from server");
+			break;
+		}
+		if (print_frame(&h, buf)) {
+			replies--;
+			fflush(stdout);
+		}
+	}
+	free(buf);
+	close(fd);
+	if (replies > 0)
+		SYSERRprintf("client read");
+}
+
 void client_cleanup(void)
 {
 	char *path = config_string("server", "socket-path");
@@ -1,2 +1,3 @@
 void ask_server(char *command);
+void ask_server_binary(char *command);
 void client_cleanup(void);
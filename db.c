@@ -0,0 +1,499 @@
+/* Append only on disk error database.
+   The file is a header followed by records. Each record carries a
+   type, two keys and a small value; the last record for a key wins
+   and a record without value deletes the key.
+   On open the file is mapped and replayed into an in memory table of
+   the live values, which is also used to write compacted files.
+
+   mcelog is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; version
+   2.
+
+   mcelog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should find a copy of v2 of the GNU General Public License somewhere
+   on your Linux system; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA */
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <libgen.h>
+#include "memutil.h"
+#include "db.h"
+
+#define DB_MAGIC "MCELOGDB"
+#define DB_VERSION 1
+#define REC_MAGIC 0x52454344	/* DCER */
+#define MIN_INDEX 64
+#define COMPACT_MIN 65536
+
+struct db_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t pad;
+};
+
+struct db_rec {
+	uint32_t magic;
+	uint32_t sum;		/* FNV 1a of the rest of the record */
+	uint16_t type;
+	uint16_t len;
+	uint32_t pad;
+	uint64_t key1;
+	uint64_t key2;
+	/* value follows, padded to 8 bytes */
+};
+
+#define REC_SIZE(len) (sizeof(struct db_rec) + (((len) + 7) & ~7U))
+
+struct db_entry {
+	uint16_t type;
+	uint16_t len;
+	uint64_t key1;
+	uint64_t key2;
+	void *val;		/* NULL: deleted */
+};
+
+struct db {
+	char *fn;
+	int fd;
+	unsigned long size;	/* file size */
+	unsigned long records;	/* records in the file */
+	unsigned long live;	/* keys with a value */
+	unsigned numentries, maxentries;
+	struct db_entry *entries;
+	unsigned indexsize;	/* power of two */
+	unsigned *index;	/* entries slot + 1, 0 is empty */
+};
+
+static uint32_t fnv(uint32_t h, const void *p, size_t len)
+{
+	const unsigned char *s = p;
+
+	while (len--)
+		h = (h ^ *s++) * 0x01000193;
+	return h;
+}
+
+static uint32_t rec_sum(const struct db_rec *r)
+{
+	uint32_t h = 2166136261U;
+
+	h = fnv(h, &r->type, sizeof(struct db_rec) - offsetof(struct db_rec, type));
+	return fnv(h, r + 1, r->len);
+}
+
+static unsigned keyhash(unsigned type, uint64_t key1, uint64_t key2)
+{
+	uint64_t h = (key1 * 0x9e3779b97f4a7c15ULL) ^ (key2 + type) * 0xc2b2ae3d27d4eb4fULL;
+
+	return h ^ (h >> 32);
+}
+
+static unsigned *index_slot(struct db *db, unsigned type, uint64_t key1, uint64_t key2)
+{
+	unsigned mask = db->indexsize - 1;
+	unsigned h = keyhash(type, key1, key2) & mask;
+	struct db_entry *e;
+
+	for (;;) {
+		unsigned *slot = &db->index[h];
+		if (*slot == 0)
+			return slot;
+		e = &db->entries[*slot - 1];
+		if (e->type == type && e->key1 == key1 && e->key2 == key2)
+			return slot;
+		h = (h + 1) & mask;
+	}
+}
+
+static void reindex(struct db *db)
+{
+	unsigned i;
+
+	free(db->index);
+	db->indexsize = db->maxentries * 2;
+	db->index = xalloc(db->indexsize * sizeof(unsigned));
+	for (i = 0; i < db->numentries; i++) {
+		struct db_entry *e = &db->entries[i];
+		*index_slot(db, e->type, e->key1, e->key2) = i + 1;
+	}
+}
+
+static void grow(struct db *db)
+{
+	if (db->numentries < db->maxentries)
+		return;
+	db->maxentries = db->maxentries ? db->maxentries * 2 : MIN_INDEX / 2;
+	db->entries = xrealloc(db->entries, db->maxentries * sizeof(struct db_entry));
+	reindex(db);
+}
+
+/* Forget deleted keys */
+static void prune(struct db *db)
+{
+	unsigned i, n = 0;
+
+	for (i = 0; i < db->numentries; i++)
+		if (db->entries[i].val)
+			db->entries[n++] = db->entries[i];
+	if (n == db->numentries)
+		return;
+	db->numentries = n;
+	reindex(db);
+}
+
+/* Update the in memory value of a key. len 0 deletes it */
+static void set_entry(struct db *db, unsigned type, uint64_t key1, uint64_t key2,
+		      const void *val, unsigned len)
+{
+	struct db_entry *e;
+	unsigned *slot;
+
+	grow(db);
+	slot = index_slot(db, type, key1, key2);
+	if (*slot) {
+		e = &db->entries[*slot - 1];
+		if (!e->val && len)
+			db->live++;
+		else if (e->val && !len)
+			db->live--;
+		if (e->len != len || !e->val) {
+			free(e->val);
+			e->val = len ? xalloc_nonzero(len) : NULL;
+			e->len = len;
+		}
+	} else {
+		if (!len)
+			return;
+		*slot = db->numentries + 1;
+		e = &db->entries[db->numentries++];
+		e->type = type;
+		e->key1 = key1;
+		e->key2 = key2;
+		e->len = len;
+		e->val = xalloc_nonzero(len);
+		db->live++;
+	}
+	if (len)
+		memcpy(e->val, val, len);
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+
+	while (len > 0) {
+		ssize_t n = write(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int write_header(int fd)
+{
+	struct db_header h = { .version = DB_VERSION };
+
+	memcpy(h.magic, DB_MAGIC, sizeof(h.magic));
+	return write_all(fd, &h, sizeof(h));
+}
+
+static int write_rec(int fd, unsigned type, uint64_t key1, uint64_t key2,
+		     const void *val, unsigned len)
+{
+	char buf[REC_SIZE(len)];
+	struct db_rec *r = (struct db_rec *)buf;
+
+	memset(buf, 0, sizeof(buf));
+	r->magic = REC_MAGIC;
+	r->type = type;
+	r->len = len;
+	r->key1 = key1;
+	r->key2 = key2;
+	if (len)
+		memcpy(r + 1, val, len);
+	r->sum = rec_sum(r);
+	return write_all(fd, buf, sizeof(buf));
+}
+
+/* 
+ * Append a record. A failed write may leave part of the record in the
+ * file, which would end the replay there and cut off everything appended
+ * later. So truncate it away, and when even that fails stop writing.
+ */
+static int append_rec(struct db *db, unsigned type, uint64_t key1, uint64_t key2,
+		      const void *val, unsigned len)
+{
+	int err;
+
+	if (write_rec(db->fd, type, key1, key2, val, len) < 0) {
+		err = errno;
+		if (ftruncate(db->fd, db->size) < 0) {
+			close(db->fd);
+			db->fd = -1;
+		}
+		errno = err;
+		return -1;
+	}
+	db->size += REC_SIZE(len);
+	db->records++;
+	return 0;
+}
+
+/* Replay the records of a mapped file. Returns the end of the valid records */
+static unsigned long replay(struct db *db, const char *map, unsigned long size)
+{
+	unsigned long off = sizeof(struct db_header);
+
+	while (off + sizeof(struct db_rec) <= size) {
+		const struct db_rec *r = (const struct db_rec *)(map + off);
+
+		if (r->magic != REC_MAGIC || off + REC_SIZE(r->len) > size ||
+		    rec_sum(r) != r->sum)
+			break;
+		set_entry(db, r->type, r->key1, r->key2, r + 1, r->len);
+		db->records++;
+		off += REC_SIZE(r->len);
+	}
+	return off;
+}
+
+static int db_load(struct db *db, int readonly)
+{
+	struct db_header *h;
+	struct stat st;
+	unsigned long end;
+	char *map;
+
+	if (fstat(db->fd, &st) < 0)
+		return -1;
+	if (st.st_size == 0) {
+		if (readonly)
+			return 0;
+		db->size = sizeof(struct db_header);
+		return write_header(db->fd);
+	}
+	if ((unsigned long)st.st_size < sizeof(struct db_header)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, db->fd, 0);
+	if (map == MAP_FAILED)
+		return -1;
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	h = (struct db_header *)map;
+	if (memcmp(h->magic, DB_MAGIC, sizeof(h->magic)) || h->version != DB_VERSION) {
+		munmap(map, st.st_size);
+		errno = EINVAL;
+		return -1;
+	}
+	end = replay(db, map, st.st_size);
+	munmap(map, st.st_size);
+
+	/* Drop a partially written record at the end */
+	if (end < (unsigned long)st.st_size && !readonly && ftruncate(db->fd, end) < 0)
+		return -1;
+	db->size = end;
+	return 0;
+}
+
+struct db *db_open(const char *fn, int readonly)
+{
+	struct db *db = xalloc(sizeof(struct db));
+	int err;
+
+	db->fn = xstrdup((char *)fn);
+	if (readonly)
+		db->fd = open(fn, O_RDONLY|O_CLOEXEC);
+	else
+		db->fd = open(fn, O_RDWR|O_CREAT|O_APPEND|O_CLOEXEC, 0600);
+	if (db->fd < 0)
+		goto fail;
+	if (!readonly && flock(db->fd, LOCK_EX|LOCK_NB) < 0)
+		goto fail;
+	if (db_load(db, readonly) < 0)
+		goto fail;
+	if (readonly) {
+		close(db->fd);
+		db->fd = -1;
+	}
+	return db;
+
+fail:
+	err = errno;
+	db_close(db);
+	errno = err;
+	return NULL;
+}
+
+void db_close(struct db *db)
+{
+	unsigned i;
+
+	if (db->fd >= 0)
+		close(db->fd);
+	for (i = 0; i < db->numentries; i++)
+		free(db->entries[i].val);
+	free(db->entries);
+	free(db->index);
+	free(db->fn);
+	free(db);
+}
+
+int db_put(struct db *db, unsigned type, uint64_t key1, uint64_t key2,
+	   const void *val, unsigned len)
+{
+	if (db->fd < 0 || len == 0 || len > 0xffff) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (append_rec(db, type, key1, key2, val, len) < 0)
+		return -1;
+	set_entry(db, type, key1, key2, val, len);
+	return 0;
+}
+
+/* Return the current value of a key or NULL */
+const void *db_get(struct db *db, unsigned type, uint64_t key1, uint64_t key2,
+		   unsigned *len)
+{
+	struct db_entry *e;
+	unsigned *slot;
+
+	if (!db->indexsize)
+		return NULL;
+	slot = index_slot(db, type, key1, key2);
+	if (!*slot)
+		return NULL;
+	e = &db->entries[*slot - 1];
+	*len = e->len;
+	return e->val;
+}
+
+int db_delete(struct db *db, unsigned type, uint64_t key1, uint64_t key2)
+{
+	unsigned *slot;
+
+	if (db->fd < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (!db->indexsize)
+		return 0;
+	slot = index_slot(db, type, key1, key2);
+	if (!*slot || !db->entries[*slot - 1].val)
+		return 0;
+	if (append_rec(db, type, key1, key2, NULL, 0) < 0)
+		return -1;
+	set_entry(db, type, key1, key2, NULL, 0);
+	return 0;
+}
+
+/* Iterate over the live values in the order they were first written */
+void db_iterate(struct db *db, db_iter_t fn, void *data)
+{
+	unsigned i;
+
+	for (i = 0; i < db->numentries; i++) {
+		struct db_entry *e = &db->entries[i];
+		if (e->val)
+			fn(e->type, e->key1, e->key2, e->val, e->len, data);
+	}
+}
+
+/* Make a rename in the directory of fn durable */
+static int sync_dir(const char *fn)
+{
+	char *s = xstrdup((char *)fn);
+	int fd, ret = -1, err;
+
+	fd = open(dirname(s), O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if (fd >= 0) {
+		ret = fsync(fd);
+		err = errno;
+		close(fd);
+		errno = err;
+	}
+	free(s);
+	return ret;
+}
+
+/* Write the live values to a new file and replace the old one with it */
+int db_compact(struct db *db)
+{
+	char *tmp;
+	unsigned i;
+	unsigned long size = sizeof(struct db_header);
+	int fd, err;
+
+	if (db->fd < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	prune(db);
+	xasprintf(&tmp, "%s.tmp", db->fn);
+	fd = open(tmp, O_RDWR|O_CREAT|O_TRUNC|O_APPEND|O_CLOEXEC, 0600);
+	if (fd < 0)
+		goto fail;
+	if (flock(fd, LOCK_EX|LOCK_NB) < 0 || write_header(fd) < 0)
+		goto fail_close;
+	for (i = 0; i < db->numentries; i++) {
+		struct db_entry *e = &db->entries[i];
+		if (write_rec(fd, e->type, e->key1, e->key2, e->val, e->len) < 0)
+			goto fail_close;
+		size += REC_SIZE(e->len);
+	}
+	if (fsync(fd) < 0 || rename(tmp, db->fn) < 0)
+		goto fail_close;
+	free(tmp);
+	close(db->fd);
+	db->fd = fd;
+	db->size = size;
+	db->records = db->numentries;
+	/* The new file is in use now, only its name may not be durable yet */
+	return sync_dir(db->fn);
+
+fail_close:
+	err = errno;
+	close(fd);
+	unlink(tmp);
+	errno = err;
+fail:
+	free(tmp);
+	return -1;
+}
+
+/* Compact when more than half of a not too small file is stale */
+int db_maybe_compact(struct db *db)
+{
+	if (db->size < COMPACT_MIN || db->records < 2 * db->live)
+		return 0;
+	return db_compact(db);
+}
+
+void db_stats(struct db *db, unsigned long *records, unsigned long *live,
+	      unsigned long *size)
+{
+	*records = db->records;
+	*live = db->live;
+	*size = db->size;
+}
@@ -0,0 +1,30 @@
+#ifndef DB_H
+#define DB_H 1
+
+#include <stdint.h>
+
+/*
+ * Append only on disk key/value store. A record is identified by its
+ * type and two 64bit keys, a newer record for the same key replaces
+ * the older one and a deletion removes it. The file is compacted when most of it is stale.
+ */
+
+struct db;
+
+typedef void (*db_iter_t)(unsigned type, uint64_t key1, uint64_t key2,
+			  const void *val, unsigned len, void *data);
+
+struct db *db_open(const char *fn, int readonly);
+void db_close(struct db *db);
+int db_put(struct db *db, unsigned type, uint64_t key1, uint64_t key2,
+	   const void *val, unsigned len);
+const void *db_get(struct db *db, unsigned type, uint64_t key1, uint64_t key2,
+		   unsigned *len);
+int db_delete(struct db *db, unsigned type, uint64_t key1, uint64_t key2);
+void db_iterate(struct db *db, db_iter_t fn, void *data);
+int db_compact(struct db *db);
+int db_maybe_compact(struct db *db);
+void db_stats(struct db *db, unsigned long *records, unsigned long *live,
+	      unsigned long *size);
+
+#endif
@@ -0,0 +1,647 @@
+/* Query the persistent error database of the mcelog daemon.
+   Reads a snapshot of the database and answers questions about the
+   DIMM, channel, socket and page error counters in it.
+
+   mcelog is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; version
+   2.
+
+   mcelog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should find a copy of v2 of the GNU General Public License somewhere
+   on your Linux system; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA */
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mcelog.h"
+#include "memutil.h"
+#include "db.h"
+#include "diskdb.h"
+#include "statsfile.h"
+
+#define DEFAULT_DATABASE "/var/lib/mcelog/errors.db"
+#define DEFAULT_STATS_FILE "/run/mcelog-stats"
+#define ANY (-2)	/* -1 is a unknown channel or DIMM */
+
+struct dimm_rec {
+	int socketid;
+	int channel;
+	int dimm;
+	struct db_dimm d;
+};
+
+struct page_rec {
+	uint64_t addr;
+	struct db_page d;
+};
+
+/* DIMMs sorted by location, pages sorted by DIMM and address */
+static struct dimm_rec *dimms;
+static unsigned numdimms, maxdimms;
+static struct page_rec *pages;
+static unsigned numpages, maxpages;
+
+static struct query {
+	int socketid, channel, dimm;
+	int64_t from, to;
+} q = { ANY, ANY, ANY, 0, INT64_MAX };
+
+void Eprintf(char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	fputs("dbquery: ", stderr);
+	vfprintf(stderr, fmt, ap);
+	fputc('\n', stderr);
+	va_end(ap);
+}
+
+static noreturn void query_usage(void)
+{
+	fprintf(stderr,
+"Usage: dbquery [options] command\n"
+"Query the error database written by mcelog --daemon --database\n"
+"\n"
+"Commands:\n"
+"sockets             Error counts per socket\n"
+"channels            Error counts per memory channel\n"
+"dimms               Error counts per DIMM\n"
+"pages               Pages with corrected errors, by DIMM and address\n"
+"top N               The N pages with the most corrected errors\n"
+"stats               Database statistics\n"
+"live                Counters of the running daemon from its --stats-file\n"
+"\n"
+"Options:\n"
+"--database filename Database to read (default " DEFAULT_DATABASE ")\n"
+"--stats-file filename Statistics file for live (default " DEFAULT_STATS_FILE ")\n"
+"--socket N          Only errors on socket N\n"
+"--channel N         Only errors on channel N\n"
+"--dimm N            Only errors on DIMM N\n"
+"--from TIME         Only counters with errors at or after TIME\n"
+"--to TIME           Only counters with errors at or before TIME\n"
+"TIME is seconds since the epoch, or a number followed by s, m, h or d\n"
+"for a time that long ago.\n"
+		);
+	exit(1);
+}
+
+static int cmp_loc(int sa, int ca, int da, int sb, int cb, int db)
+{
+	if (sa != sb)
+		return sa < sb ? -1 : 1;
+	if (ca != cb)
+		return ca < cb ? -1 : 1;
+	if (da != db)
+		return da < db ? -1 : 1;
+	return 0;
+}
+
+static int cmp_dimm(const void *a, const void *b)
+{
+	const struct dimm_rec *x = a, *y = b;
+
+	return cmp_loc(x->socketid, x->channel, x->dimm,
+		       y->socketid, y->channel, y->dimm);
+}
+
+static int cmp_page(const void *a, const void *b)
+{
+	const struct page_rec *x = a, *y = b;
+	int r = cmp_loc(x->d.socketid, x->d.channel, x->d.dimm,
+			y->d.socketid, y->d.channel, y->d.dimm);
+
+	if (r)
+		return r;
+	return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+static int cmp_count(const void *a, const void *b)
+{
+	const struct page_rec *x = *(struct page_rec **)a, *y = *(struct page_rec **)b;
+
+	if (x->d.count != y->d.count)
+		return x->d.count > y->d.count ? -1 : 1;
+	return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+static void load(unsigned type, uint64_t key1, uint64_t key2,
+		 const void *val, unsigned len, void *data)
+{
+	if (type == DB_DIMM && len == sizeof(struct db_dimm)) {
+		struct dimm_rec *r;
+
+		if (numdimms == maxdimms) {
+			maxdimms = maxdimms ? maxdimms * 2 : 64;
+			dimms = xrealloc(dimms, maxdimms * sizeof(struct dimm_rec));
+		}
+		r = &dimms[numdimms++];
+		r->socketid = key1;
+		r->channel = DB_KEY_CHANNEL(key2);
+		r->dimm = DB_KEY_DIMM(key2);
+		memcpy(&r->d, val, len);
+	} else if (type == DB_PAGE && len == sizeof(struct db_page)) {
+		struct page_rec *r;
+
+		if (numpages == maxpages) {
+			maxpages = maxpages ? maxpages * 2 : 256;
+			pages = xrealloc(pages, maxpages * sizeof(struct page_rec));
+		}
+		r = &pages[numpages++];
+		r->addr = key1;
+		memcpy(&r->d, val, len);
+	}
+}
+
+/* First DIMM at or after a location */
+static unsigned dimm_lower(int socketid, int channel, int dimm)
+{
+	unsigned lo = 0, hi = numdimms;
+
+	while (lo < hi) {
+		unsigned mid = (lo + hi) / 2;
+		struct dimm_rec *r = &dimms[mid];
+
+		if (cmp_loc(r->socketid, r->channel, r->dimm, socketid, channel, dimm) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static unsigned page_lower(int socketid, int channel, int dimm)
+{
+	unsigned lo = 0, hi = numpages;
+
+	while (lo < hi) {
+		unsigned mid = (lo + hi) / 2;
+		struct db_page *d = &pages[mid].d;
+
+		if (cmp_loc(d->socketid, d->channel, d->dimm, socketid, channel, dimm) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static int match_loc(int socketid, int channel, int dimm)
+{
+	return (q.socketid == ANY || q.socketid == socketid) &&
+	       (q.channel == ANY || q.channel == channel) &&
+	       (q.dimm == ANY || q.dimm == dimm);
+}
+
+static int match_time(int64_t first, int64_t last)
+{
+	return last >= q.from && first <= q.to;
+}
+
+/* Range of DIMMs that can match the location in the query */
+static void dimm_range(unsigned *start, unsigned *end)
+{
+	if (q.socketid == ANY) {
+		*start = 0;
+		*end = numdimms;
+	} else if (q.channel == ANY) {
+		*start = dimm_lower(q.socketid, -1, -1);
+		*end = dimm_lower(q.socketid + 1, -1, -1);
+	} else {
+		*start = dimm_lower(q.socketid, q.channel, -1);
+		*end = dimm_lower(q.socketid, q.channel + 1, -1);
+	}
+}
+
+static char *timestr(char *buf, size_t size, int64_t t)
+{
+	time_t tt = t;
+	struct tm *tm = localtime(&tt);
+
+	if (!tm || !strftime(buf, size, "%F %T", tm))
+		snprintf(buf, size, "%lld", (long long)t);
+	return buf;
+}
+
+static void print_times(int64_t first, int64_t last)
+{
+	char b1[64], b2[64];
+
+	printf("\tfirst %s last %s\n", timestr(b1, sizeof(b1), first),
+	       timestr(b2, sizeof(b2), last));
+}
+
+static void print_loc(const char *what, int n)
+{
+	if (n == -1)
+		printf(" %s any", what);
+	else
+		printf(" %s %d", what, n);
+}
+
+struct sum {
+	unsigned long ce, uc;
+	int64_t first, last;
+	int n;
+};
+
+static void add_sum(struct sum *s, struct db_dimm *d)
+{
+	if (s->n++ == 0) {
+		s->first = d->first;
+		s->last = d->last;
+	}
+	if (d->first < s->first)
+		s->first = d->first;
+	if (d->last > s->last)
+		s->last = d->last;
+	s->ce += d->ce_count;
+	s->uc += d->uc_count;
+}
+
+static void print_sum(struct sum *s)
+{
+	printf("\t%lu corrected %lu uncorrected\n", s->ce, s->uc);
+	print_times(s->first, s->last);
+}
+
+/* The socket tracking counters (channel and DIMM any) count all errors
+   of a socket, otherwise add up the DIMMs. */
+static void cmd_sockets(void)
+{
+	unsigned i, start, end;
+
+	dimm_range(&start, &end);
+	for (i = start; i < end; ) {
+		struct sum dimm = {}, socket = {};
+		int s = dimms[i].socketid;
+
+		for (; i < end && dimms[i].socketid == s; i++) {
+			struct dimm_rec *r = &dimms[i];
+
+			if (!match_loc(r->socketid, r->channel, r->dimm) ||
+			    !match_time(r->d.first, r->d.last))
+				continue;
+			if (r->channel == -1 && r->dimm == -1)
+				add_sum(&socket, &r->d);
+			else
+				add_sum(&dimm, &r->d);
+		}
+		if (socket.n + dimm.n == 0)
+			continue;
+		printf("SOCKET %d\n", s);
+		print_sum(socket.n ? &socket : &dimm);
+	}
+}
+
+static void cmd_channels(void)
+{
+	unsigned i, start, end;
+
+	dimm_range(&start, &end);
+	for (i = start; i < end; ) {
+		struct sum sum = {};
+		int s = dimms[i].socketid, c = dimms[i].channel;
+
+		for (; i < end && dimms[i].socketid == s && dimms[i].channel == c; i++) {
+			struct dimm_rec *r = &dimms[i];
+
+			if (r->channel == -1 ||
+			    !match_loc(r->socketid, r->channel, r->dimm) ||
+			    !match_time(r->d.first, r->d.last))
+				continue;
+			add_sum(&sum, &r->d);
+		}
+		if (sum.n == 0)
+			continue;
+		printf("SOCKET %d CHANNEL %d\n", s, c);
+		print_sum(&sum);
+	}
+}
+
+static void cmd_dimms(void)
+{
+	unsigned i, start, end;
+
+	dimm_range(&start, &end);
+	for (i = start; i < end; i++) {
+		struct dimm_rec *r = &dimms[i];
+
+		if (!match_loc(r->socketid, r->channel, r->dimm) ||
+		    !match_time(r->d.first, r->d.last))
+			continue;
+		printf("SOCKET %d", r->socketid);
+		print_loc("CHANNEL", r->channel);
+		print_loc("DIMM", r->dimm);
+		printf("\n\t%u corrected %u uncorrected\n", r->d.ce_count, r->d.uc_count);
+		print_times(r->d.first, r->d.last);
+	}
+}
+
+static void print_page(struct page_rec *p)
+{
+	static const char *state[] = { "online", "offline", "offline-failed" };
+
+	printf("%llx: total %u %s%s", (unsigned long long)p->addr, p->d.count,
+	       p->d.offlined < 3 ? state[p->d.offlined] : "?",
+	       p->d.triggered ? " triggered" : "");
+	if (p->d.socketid != -1) {
+		printf(" SOCKET %d", p->d.socketid);
+		print_loc("CHANNEL", p->d.channel);
+		print_loc("DIMM", p->d.dimm);
+	}
+	putchar('\n');
+	print_times(p->d.first, p->d.last);
+}
+
+static void cmd_pages(void)
+{
+	unsigned i, start = 0, end = numpages;
+
+	if (q.socketid != ANY && q.channel != ANY && q.dimm != ANY) {
+		start = page_lower(q.socketid, q.channel, q.dimm);
+		end = page_lower(q.socketid, q.channel, q.dimm + 1);
+	}
+	for (i = start; i < end; i++) {
+		struct page_rec *p = &pages[i];
+
+		if (match_loc(p->d.socketid, p->d.channel, p->d.dimm) &&
+		    match_time(p->d.first, p->d.last))
+			print_page(p);
+	}
+}
+
+static void cmd_top(unsigned n)
+{
+	struct page_rec **top = xalloc((numpages + 1) * sizeof(void *));
+	unsigned i, k = 0;
+
+	for (i = 0; i < numpages; i++) {
+		struct page_rec *p = &pages[i];
+
+		if (match_loc(p->d.socketid, p->d.channel, p->d.dimm) &&
+		    match_time(p->d.first, p->d.last))
+			top[k++] = p;
+	}
+	qsort(top, k, sizeof(void *), cmp_count);
+	for (i = 0; i < k && i < n; i++)
+		print_page(top[i]);
+	free(top);
+}
+
+static void cmd_stats(struct db *db)
+{
+	unsigned long records, live, size;
+
+	db_stats(db, &records, &live, &size);
+	printf("%lu records %lu live %lu bytes\n", records, live, size);
+	printf("%u DIMMs %u pages\n", numdimms, numpages);
+}
+
+/*
+ * Copy the statistics file while the daemon does not update it. Never
+ * writes to the file, so it does not delay the daemon.
+ */
+static struct stats_header *stats_snapshot(const char *fn)
+{
+	struct stats_header *h, *copy = NULL;
+	struct stat st;
+	size_t mapped = 0;
+	void *map = NULL;
+	uint32_t seq, size;
+	int fd;
+
+	fd = open(fn, O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	for (;;) {
+		if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct stats_header))
+			goto err;
+		if (mapped != (size_t)st.st_size) {
+			if (map)
+				munmap(map, mapped);
+			map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+			if (map == MAP_FAILED) {
+				map = NULL;
+				goto err;
+			}
+			mapped = st.st_size;
+		}
+		h = map;
+		if (h->magic != STATS_MAGIC || h->version != STATS_VERSION) {
+			errno = EINVAL;
+			goto err;
+		}
+		seq = __atomic_load_n(&h->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			sched_yield();
+			continue;
+		}
+		size = h->size;
+		if (size > mapped)
+			continue;
+		copy = xrealloc(copy, size);
+		memcpy(copy, map, size);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&h->seq, __ATOMIC_RELAXED) == seq)
+			break;
+	}
+	munmap(map, mapped);
+	close(fd);
+	return copy;
+
+err:
+	if (map)
+		munmap(map, mapped);
+	free(copy);
+	close(fd);
+	return NULL;
+}
+
+static void print_bucket(const char *what, struct stats_bucket *b)
+{
+	if (b->count || b->excess)
+		printf(" %s %u+%u", what, b->count, b->excess);
+}
+
+static void cmd_live(const char *fn)
+{
+	struct stats_header *h = stats_snapshot(fn);
+	struct stats_dimm *d;
+	struct stats_reporter *r;
+	unsigned i;
+
+	if (!h) {
+		fprintf(stderr, "dbquery: Cannot read stats file `%s': %s\n", fn,
+			strerror(errno));
+		exit(1);
+	}
+	printf("daemon %d updated %lld\n", h->pid, (long long)h->updated);
+	printf("%u page counters of %u, %u replacements", h->page_counters,
+	       h->page_counters_max, h->replacements);
+	print_bucket("bucket", &h->replacement_bucket);
+	printf("\n");
+	d = (struct stats_dimm *)((char *)h + h->dimm_off);
+	for (i = 0; i < h->ndimms; i++, d++) {
+		if (!match_loc(d->socketid, d->channel, d->dimm))
+			continue;
+		printf("SOCKET %d", d->socketid);
+		print_loc("CHANNEL", d->channel);
+		print_loc("DIMM", d->dimm);
+		if (d->location[0] || d->name[0])
+			printf(" [%s %s]", d->location, d->name);
+		printf("\n\t%u corrected %u uncorrected", d->ce_count, d->uc_count);
+		print_bucket("ce-bucket", &d->ce);
+		print_bucket("uc-bucket", &d->uc);
+		printf("\n");
+	}
+	r = (struct stats_reporter *)((char *)h + h->reporter_off);
+	for (i = 0; i < h->nreporters; i++, r++)
+		printf("trigger %s: started %llu queued %llu dropped %llu failed %llu "
+		       "coalesced %llu sent %llu pending %u max-pending %u\n",
+		       r->name, (unsigned long long)r->started,
+		       (unsigned long long)r->queued, (unsigned long long)r->dropped,
+		       (unsigned long long)r->failed, (unsigned long long)r->coalesced,
+		       (unsigned long long)r->sent, r->pending, r->max_pending);
+	free(h);
+}
+
+static int64_t parse_time(char *s)
+{
+	char *end;
+	long long n = strtoll(s, &end, 0);
+	int unit;
+
+	switch (*end) {
+	case 0:
+		return n;
+	case 's': unit = 1; break;
+	case 'm': unit = 60; break;
+	case 'h': unit = 3600; break;
+	case 'd': unit = 24*3600; break;
+	default:
+		query_usage();
+	}
+	if (end[1])
+		query_usage();
+	return time(NULL) - n * unit;
+}
+
+static int parse_num(char *s)
+{
+	char *end;
+	long n = strtol(s, &end, 0);
+
+	if (*end || end == s)
+		query_usage();
+	return n;
+}
+
+enum {
+	Q_DATABASE = 1,
+	Q_STATS_FILE,
+	Q_SOCKET,
+	Q_CHANNEL,
+	Q_DIMM,
+	Q_FROM,
+	Q_TO,
+	Q_HELP,
+};
+
+static struct option options[] = {
+	{ "database", 1, NULL, Q_DATABASE },
+	{ "stats-file", 1, NULL, Q_STATS_FILE },
+	{ "socket", 1, NULL, Q_SOCKET },
+	{ "channel", 1, NULL, Q_CHANNEL },
+	{ "dimm", 1, NULL, Q_DIMM },
+	{ "from", 1, NULL, Q_FROM },
+	{ "to", 1, NULL, Q_TO },
+	{ "help", 0, NULL, Q_HELP },
+	{}
+};
+
+int main(int ac, char **av)
+{
+	char *fn = DEFAULT_DATABASE;
+	char *stats_fn = DEFAULT_STATS_FILE;
+	struct db *db;
+	char *cmd;
+	int opt;
+
+	while ((opt = getopt_long(ac, av, "", options, NULL)) != -1) {
+		switch (opt) {
+		case Q_DATABASE:
+			fn = optarg;
+			break;
+		case Q_STATS_FILE:
+			stats_fn = optarg;
+			break;
+		case Q_SOCKET:
+			q.socketid = parse_num(optarg);
+			break;
+		case Q_CHANNEL:
+			q.channel = parse_num(optarg);
+			break;
+		case Q_DIMM:
+			q.dimm = parse_num(optarg);
+			break;
+		case Q_FROM:
+			q.from = parse_time(optarg);
+			break;
+		case Q_TO:
+			q.to = parse_time(optarg);
+			break;
+		default:
+			query_usage();
+		}
+	}
+	cmd = av[optind];
+	if (!cmd)
+		query_usage();
+	if (!strcmp(cmd, "live") && !av[optind + 1]) {
+		cmd_live(stats_fn);
+		return 0;
+	}
+
+	db = db_open(fn, 1);
+	if (!db) {
+		fprintf(stderr, "dbquery: Cannot open database `%s': %s\n", fn,
+			strerror(errno));
+		exit(1);
+	}
+	db_iterate(db, load, NULL);
+	qsort(dimms, numdimms, sizeof(struct dimm_rec), cmp_dimm);
+	qsort(pages, numpages, sizeof(struct page_rec), cmp_page);
+
+	if (!strcmp(cmd, "sockets") && !av[optind + 1])
+		cmd_sockets();
+	else if (!strcmp(cmd, "channels") && !av[optind + 1])
+		cmd_channels();
+	else if (!strcmp(cmd, "dimms") && !av[optind + 1])
+		cmd_dimms();
+	else if (!strcmp(cmd, "pages") && !av[optind + 1])
+		cmd_pages();
+	else if (!strcmp(cmd, "top") && av[optind + 1] && !av[optind + 2])
+		cmd_top(parse_num(av[optind + 1]));
+	else if (!strcmp(cmd, "stats") && !av[optind + 1])
+		cmd_stats(db);
+	else
+		query_usage();
+	db_close(db);
+	return 0;
+}
@@ -34,8 +34,10 @@ static struct field mc_bits[] = {
 	{}
 };
 
-void denverton_decode_model(int cputype, int bank, u64 status, u64 misc)
+void denverton_decode_model(int cputype, struct mce *m)
 {
+	int bank = m->bank;
+	u64 status = m->status;
 	switch (bank) {
 	case 6: case 7:
 		Wprintf("MemCtrl: ");
@@ -1 +1 @@
-void denverton_decode_model(int cputype, int bank, u64 status, u64 misc);
+void denverton_decode_model(int cputype, struct mce *m);
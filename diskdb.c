@@ -0,0 +1,151 @@
+/* Persistent error database for the daemon.
+   The DIMM and page error counters and their leaky buckets are written
+   to an append only database on every update and restored on startup,
+   so a restarted daemon continues with the thresholds it had.
+
+   mcelog is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; version
+   2.
+
+   mcelog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should find a copy of v2 of the GNU General Public License somewhere
+   on your Linux system; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA */
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include "mcelog.h"
+#include "leaky-bucket.h"
+#include "eventloop.h"
+#include "db.h"
+#include "diskdb.h"
+
+#define COMPACT_INTERVAL (3600 * 1000)
+
+static char *database;
+static struct db *db;
+
+int diskdb_modifier(int opt)
+{
+	switch (opt) {
+	case O_DATABASE:
+		database = optarg;
+		break;
+	default:
+		return 0;
+	}
+	return 1;
+}
+
+void diskdb_usage(void)
+{
+	fprintf(stderr,
+"--database filename Keep the memory error counters of the daemon in filename\n"
+		);
+}
+
+void diskdb_bucket(struct db_bucket *d, const struct leaky_bucket *b)
+{
+	d->count = b->count;
+	d->excess = b->excess;
+	d->tstamp = b->tstamp;
+}
+
+void diskdb_restore_bucket(struct leaky_bucket *b, const struct db_bucket *d)
+{
+	b->count = d->count;
+	b->excess = d->excess;
+	b->tstamp = d->tstamp;
+}
+
+void diskdb_put(unsigned type, uint64_t key1, uint64_t key2, const void *val,
+		unsigned len)
+{
+	if (db && db_put(db, type, key1, key2, val, len) < 0)
+		SYSERRprintf("Cannot write to database `%s'", database);
+}
+
+/* Time of the first error of a record that is about to be written at t */
+int64_t diskdb_first(unsigned type, uint64_t key1, uint64_t key2, unsigned len,
+		     int64_t t)
+{
+	const void *old;
+	unsigned oldlen;
+
+	if (!db)
+		return t;
+	old = db_get(db, type, key1, key2, &oldlen);
+	if (!old || oldlen != len)
+		return t;
+	switch (type) {
+	case DB_DIMM:
+		return ((const struct db_dimm *)old)->first;
+	case DB_PAGE:
+		return ((const struct db_page *)old)->first;
+	}
+	return t;
+}
+
+void diskdb_delete(unsigned type, uint64_t key1, uint64_t key2)
+{
+	if (db && db_delete(db, type, key1, key2) < 0)
+		SYSERRprintf("Cannot write to database `%s'", database);
+}
+
+static void restore(unsigned type, uint64_t key1, uint64_t key2,
+		    const void *val, unsigned len, void *data)
+{
+	unsigned *n = data;
+
+	switch (type) {
+	case DB_DIMM:
+		if (len != sizeof(struct db_dimm))
+			return;
+		memdb_restore(key1, key2, val);
+		break;
+	case DB_PAGE:
+		if (len != sizeof(struct db_page))
+			return;
+		page_restore(key1, val);
+		break;
+	case DB_PAGE_REPLACEMENT:
+		if (len != sizeof(struct db_counter))
+			return;
+		page_restore_replacement(val);
+		break;
+	default:
+		return;
+	}
+	(*n)++;
+}
+
+static void compact(void *data)
+{
+	if (db_maybe_compact(db) < 0)
+		SYSERRprintf("Cannot compact database `%s'", database);
+}
+
+/* Open the database and restore the counters. Needs memdb and pages set up */
+void diskdb_setup(void)
+{
+	unsigned n = 0;
+
+	if (!database)
+		return;
+	db = db_open(database, 0);
+	if (!db) {
+		SYSERRprintf("Cannot open database `%s'", database);
+		return;
+	}
+	db_iterate(db, restore, &n);
+	if (n > 0)
+		Lprintf("Restored %u error counters from `%s'\n", n, database);
+	compact(NULL);
+	register_timercb(COMPACT_INTERVAL, compact, NULL);
+}
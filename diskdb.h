@@ -0,0 +1,80 @@
+#ifndef DISKDB_H
+#define DISKDB_H 1
+
+#include <stdint.h>
+
+/* Record types and values of the persistent error database */
+
+enum diskdb_type {
+	DB_DIMM = 1,		/* key1 socket, key2 channel << 32 | dimm */
+	DB_PAGE = 2,		/* key1 page address */
+	DB_PAGE_REPLACEMENT = 3,
+};
+
+#define DB_DIMM_KEY(channel, dimm) \
+	((uint64_t)(uint32_t)(channel) << 32 | (uint32_t)(dimm))
+#define DB_KEY_CHANNEL(k) ((int)((k) >> 32))
+#define DB_KEY_DIMM(k) ((int)(uint32_t)(k))
+
+struct db_bucket {
+	uint32_t count;
+	uint32_t excess;
+	int64_t tstamp;
+};
+
+/* first and last are the times of the first and the last error */
+struct db_dimm {
+	uint32_t ce_count;
+	uint32_t uc_count;
+	struct db_bucket ce;
+	struct db_bucket uc;
+	int64_t first;
+	int64_t last;
+};
+
+struct db_page {
+	uint32_t count;
+	uint8_t offlined;
+	uint8_t triggered;
+	uint8_t offline_threshold_multiplier;
+	uint8_t pad;
+	struct db_bucket bucket;
+	int32_t socketid;	/* DIMM of the last error, -1: unknown */
+	int32_t channel;
+	int32_t dimm;
+	uint32_t pad2;
+	int64_t first;
+	int64_t last;
+};
+
+struct db_counter {
+	uint32_t count;
+	uint32_t pad;
+	struct db_bucket bucket;
+};
+
+enum diskdb_options {
+	O_DATABASE = O_DISKDB,
+};
+
+#define DISKDB_OPTIONS \
+	{ "database", 1, NULL, O_DATABASE },
+
+struct leaky_bucket;
+
+int diskdb_modifier(int opt);
+void diskdb_usage(void);
+void diskdb_setup(void);
+void diskdb_put(unsigned type, uint64_t key1, uint64_t key2, const void *val,
+		unsigned len);
+void diskdb_delete(unsigned type, uint64_t key1, uint64_t key2);
+int64_t diskdb_first(unsigned type, uint64_t key1, uint64_t key2, unsigned len,
+		     int64_t t);
+void diskdb_bucket(struct db_bucket *d, const struct leaky_bucket *b);
+void diskdb_restore_bucket(struct leaky_bucket *b, const struct db_bucket *d);
+
+void memdb_restore(uint64_t socket, uint64_t chdimm, const struct db_dimm *d);
+void page_restore(uint64_t addr, const struct db_page *d);
+void page_restore_replacement(const struct db_counter *d);
+
+#endif
@@ -102,8 +102,10 @@ static void dunnington_decode_internal(u64 status)
 		decode_bitfield(mca, dnt_uecc);
 }
 
-void dunnington_decode_model(u64 status)
+void dunnington_decode_model(int cputype, struct mce *m)
 {
+	u64 status = m->status;
+
 	if ((status & 0xffff) == 0xe0f)
 		dunnington_decode_bus(status);
 	else if ((status & 0xffff) == (1 << 10))
@@ -1,2 +1,2 @@
-void dunnington_decode_model(u64 status);
+void dunnington_decode_model(int cputype, struct mce *m);
 
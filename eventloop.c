@@ -18,27 +18,42 @@
 #define _GNU_SOURCE 1
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <string.h>
 #include <sys/fcntl.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #include <signal.h>
+#include <unistd.h>
 #include "mcelog.h"
+#include "memutil.h"
 #include "eventloop.h"
 
-#define MAX_POLLFD 10
-
-static int max_pollfd;
+#define MAX_EVENTS 16
 
+/* The pollfd is passed to the callbacks, which may change its events */
 struct pollcb { 
+	struct pollfd pfd;
 	poll_cb_t cb;
-	int fd;
+	void *data;
+	int events;		/* events registered with epoll */
+	struct pollcb *next;	/* on dead list */
+};
+
+struct timercb {
+	timer_cb_t cb;
 	void *data;
 };
 
-static struct pollfd pollfds[MAX_POLLFD];
-static struct pollcb pollcbs[MAX_POLLFD];	
+static int epfd = -1;
+static struct pollcb *dead;
 
-static sigset_t event_sigs;
+static int sigfd = -1;
+static sigset_t sigfd_mask;
+static sigset_t orig_mask;
+static signal_cb_t signal_cbs[_NSIG];
 
 static int closeonexec(int fd)
 {
@@ -50,98 +65,250 @@ static int closeonexec(int fd)
 	return 0;
 }
 
-int register_pollcb(int fd, int events, poll_cb_t cb, void *data)
+/* Like register_pollcb, but return the pollfd for set_pollcb_events */
+struct pollfd *add_pollcb(int fd, int events, poll_cb_t cb, void *data)
 {
-	int i = max_pollfd;
+	struct epoll_event ev;
+	struct pollcb *c;
 
 	if (closeonexec(fd) < 0)
-		return -1;
+		return NULL;
 
-	if (i >= MAX_POLLFD) {
-		Eprintf("poll table overflow");
-		return -1;
+	if (epfd < 0) {
+		epfd = epoll_create1(EPOLL_CLOEXEC);
+		if (epfd < 0) {
+			SYSERRprintf("Cannot create epoll fd");
+			return NULL;
+		}
 	}
-	max_pollfd++;
 
-	pollfds[i].fd = fd;
-	pollfds[i].events = events;
-	pollcbs[i].cb = cb;
-	pollcbs[i].data = data;
-	return 0;
+	c = xalloc(sizeof(struct pollcb));
+	c->pfd.fd = fd;
+	c->pfd.events = events;
+	c->cb = cb;
+	c->data = data;
+	c->events = events;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = c;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		SYSERRprintf("Cannot add fd to epoll set");
+		free(c);
+		return NULL;
+	}
+	return &c->pfd;
+}
+
+int register_pollcb(int fd, int events, poll_cb_t cb, void *data)
+{
+	return add_pollcb(fd, events, cb, data) ? 0 : -1;
+}
+
+/* 
+ * Change the events to wait for outside of the fd's callback. In the
+ * callback it is enough to change pfd->events.
+ */
+void set_pollcb_events(struct pollfd *pfd, int events)
+{
+	struct pollcb *c = (struct pollcb *)pfd;
+	struct epoll_event ev;
+
+	pfd->events = events;
+	if (c->events == events)
+		return;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = c;
+	if (epoll_ctl(epfd, EPOLL_CTL_MOD, pfd->fd, &ev) < 0)
+		SYSERRprintf("Cannot change epoll events");
+	else
+		c->events = events;
 }
 
-/* Could mark free and put into a free list */
+/* 
+ * Can be called from the callback. Has to be called before the fd is
+ * closed, a reused fd number would be another registration.
+ * The pollcb is only freed after the current batch of events.
+ */
 void unregister_pollcb(struct pollfd *pfd)
 {
-	int i = pfd - pollfds;
-	assert(i >= 0 && i < max_pollfd);
-	memmove(pollfds + i, pollfds + i + 1, 
-		(max_pollfd - i - 1) * sizeof(struct pollfd));
-	memmove(pollcbs + i, pollcbs + i + 1, 
-		(max_pollfd - i - 1) * sizeof(struct pollcb));
-	max_pollfd--;
+	struct pollcb *c = (struct pollcb *)pfd;
+
+	assert(c->cb != NULL);
+	if (epoll_ctl(epfd, EPOLL_CTL_DEL, pfd->fd, NULL) < 0)
+		SYSERRprintf("Cannot remove fd from epoll set");
+	c->cb = NULL;
+	c->next = dead;
+	dead = c;
 }
 
-static void poll_callbacks(int n)
+static void poll_callbacks(struct epoll_event *events, int n)
 {
 	int k;
 
-	for (k = 0; k < max_pollfd && n > 0; k++) {
-		struct pollfd *f = pollfds + k;
-		if (f->revents) { 
-			struct pollcb *c = pollcbs + k;
-			c->cb(f, c->data);
-			n--;
+	for (k = 0; k < n; k++) {
+		struct pollcb *c = events[k].data.ptr;
+
+		if (!c->cb)
+			continue;
+		c->pfd.revents = events[k].events;
+		c->cb(&c->pfd, c->data);
+		if (c->cb && c->pfd.events != c->events) {
+			struct epoll_event ev;
+
+			memset(&ev, 0, sizeof(ev));
+			ev.events = c->pfd.events;
+			ev.data.ptr = c;
+			if (epoll_ctl(epfd, EPOLL_CTL_MOD, c->pfd.fd, &ev) < 0)
+				SYSERRprintf("Cannot change epoll events");
+			else
+				c->events = c->pfd.events;
 		}
 	}
+
+	while (dead) {
+		struct pollcb *c = dead;
+		dead = c->next;
+		free(c);
+	}
 }
 
-/* Run signal handler only directly after event loop */
-int event_signal(int sig)
+static void signal_event(struct pollfd *pfd, void *data)
+{
+	struct signalfd_siginfo si;
+
+	while (read(pfd->fd, &si, sizeof(si)) == sizeof(si)) {
+		if (si.ssi_signo < _NSIG && signal_cbs[si.ssi_signo])
+			signal_cbs[si.ssi_signo](si.ssi_signo);
+	}
+}
+
+/* 
+ * Deliver sig through a signalfd in the event loop. The signal stays
+ * blocked outside the loop, so cb runs in normal context.
+ */
+int register_signalcb(int sig, signal_cb_t cb)
 {
 	static int first = 1;
-	sigset_t mask;
-	if (first && sigprocmask(SIG_BLOCK, NULL, &event_sigs) < 0) 
+	int fd;
+
+	if (first && sigprocmask(SIG_BLOCK, NULL, &orig_mask) < 0)
 		return -1;
 	first = 0;
-	if (sigprocmask(SIG_BLOCK, NULL, &mask) < 0)
+	sigaddset(&sigfd_mask, sig);
+	if (sigprocmask(SIG_BLOCK, &sigfd_mask, NULL) < 0)
 		return -1;
-	sigaddset(&mask, sig);
-	if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+	signal_cbs[sig] = cb;
+
+	fd = signalfd(sigfd, &sigfd_mask, SFD_NONBLOCK|SFD_CLOEXEC);
+	if (fd < 0) {
+		SYSERRprintf("Cannot create signalfd");
 		return -1;
+	}
+	if (sigfd < 0) {
+		sigfd = fd;
+		return register_pollcb(sigfd, POLLIN, signal_event, NULL);
+	}
 	return 0;
 }
 
-/* Handle old glibc without ppoll. */
-static int ppoll_fallback(struct pollfd *pfd, nfds_t nfds, 
-			  const struct timespec *ts, const sigset_t *ss)
+/* Undo the signal blocking in a child before exec */
+void restore_sigmask(void)
+{
+	if (sigfd >= 0)
+		sigprocmask(SIG_SETMASK, &orig_mask, NULL);
+}
+
+/* The signal mask a spawned child should start with */
+void child_sigmask(sigset_t *mask)
+{
+	if (sigfd >= 0)
+		*mask = orig_mask;
+	else
+		sigprocmask(SIG_BLOCK, NULL, mask);
+}
+
+static void timer_event(struct pollfd *pfd, void *data)
+{
+	struct timercb *t = data;
+	u64 expirations;
+
+	if (read(pfd->fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+		t->cb(t->data);
+}
+
+static int new_timer(struct itimerspec *its, timer_cb_t cb, void *data)
+{
+	struct timercb *t;
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+	if (fd < 0) {
+		SYSERRprintf("Cannot create timerfd");
+		return -1;
+	}
+	if (timerfd_settime(fd, 0, its, NULL) < 0) {
+		SYSERRprintf("Cannot set timerfd");
+		close(fd);
+		return -1;
+	}
+	t = xalloc(sizeof(struct timercb));
+	t->cb = cb;
+	t->data = data;
+	if (register_pollcb(fd, POLLIN, timer_event, t) < 0) {
+		close(fd);
+		free(t);
+		return -1;
+	}
+	return fd;
+}
+
+/* Call cb every msec milliseconds from the event loop */
+int register_timercb(unsigned msec, timer_cb_t cb, void *data)
 {
-	sigset_t origmask;
-	int ready;
-	sigprocmask(SIG_SETMASK, ss, &origmask);
-	ready = poll(pfd, nfds, ts ? ts->tv_sec : -1);
-	sigprocmask(SIG_SETMASK, &origmask, NULL);
-	return ready;
+	struct itimerspec its = {
+		.it_interval = { msec / 1000, (msec % 1000) * 1000000 },
+	};
+
+	its.it_value = its.it_interval;
+	return new_timer(&its, cb, data) < 0 ? -1 : 0;
 }
 
-static int (*ppoll_vec)(struct pollfd *, nfds_t, const struct timespec
-			*, const sigset_t *);
+/* Register a timer that calls cb once each time it is armed with arm_timer */
+int register_oneshot_timercb(timer_cb_t cb, void *data)
+{
+	struct itimerspec its = {};
+
+	return new_timer(&its, cb, data);
+}
+
+int arm_timer(int timer, unsigned msec)
+{
+	struct itimerspec its = {
+		.it_value = { msec / 1000, (msec % 1000) * 1000000 },
+	};
+
+	if (msec == 0)
+		its.it_value.tv_nsec = 1;
+	if (timerfd_settime(timer, 0, &its, NULL) < 0) {
+		SYSERRprintf("Cannot set timerfd");
+		return -1;
+	}
+	return 0;
+}
 
 void eventloop(void)
 {
-#if __GLIBC__ == 2 && __GLIBC_MINOR__ >= 5 || __GLIBC__ > 2
-	ppoll_vec = ppoll;
-#endif
-	if (!ppoll_vec) 
-		ppoll_vec = ppoll_fallback;
+	struct epoll_event events[MAX_EVENTS];
 
 	for (;;) { 
-		int n = ppoll_vec(pollfds, max_pollfd, NULL, &event_sigs);
+		int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
 		if (n <= 0) {
 			if (n < 0 && errno != EINTR)
 				SYSERRprintf("poll error");
 			continue;
 		}
-		poll_callbacks(n); 
+		poll_callbacks(events, n); 
 	}			
 }
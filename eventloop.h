@@ -1,8 +1,20 @@
 #include <poll.h>
+#include <signal.h>
 
 typedef void (*poll_cb_t)(struct pollfd *pfd, void *data);
 
 int register_pollcb(int fd, int events, poll_cb_t cb, void *data);
+struct pollfd *add_pollcb(int fd, int events, poll_cb_t cb, void *data);
+void set_pollcb_events(struct pollfd *pfd, int events);
 void unregister_pollcb(struct pollfd *pfd);
 void eventloop(void);
-int event_signal(int sig);
+
+typedef void (*signal_cb_t)(int sig);
+typedef void (*timer_cb_t)(void *data);
+
+int register_signalcb(int sig, signal_cb_t cb);
+void restore_sigmask(void);
+void child_sigmask(sigset_t *mask);
+int register_timercb(unsigned msec, timer_cb_t cb, void *data);
+int register_oneshot_timercb(timer_cb_t cb, void *data);
+int arm_timer(int timer, unsigned msec);
@@ -236,8 +236,10 @@ static void granite_imc_misc(u64 status, u64 misc)
 		Wprintf("transient\n");
 }
 
-void granite_decode_model(int cputype, int bank, u64 status, u64 misc)
+void granite_decode_model(int cputype, struct mce *m)
 {
+	int bank = m->bank;
+	u64 status = m->status, misc = m->misc;
 	u64 f;
 
 	switch (bank) {
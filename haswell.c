@@ -115,8 +115,10 @@ static struct field memctrl_mc9[] = {
 	{}
 };
 
-void hsw_decode_model(int cputype, int bank, u64 status, u64 misc)
+void hsw_decode_model(int cputype, struct mce *m)
 {
+	int bank = m->bank;
+	u64 status = m->status;
 	switch (bank) {
 	case 4:
 		Wprintf("PCU: ");
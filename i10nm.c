@@ -353,8 +353,10 @@ static enum banktype tremont[32] = {
 	[13 ... 15]	= BT_IMC,
 };
 
-void i10nm_decode_model(int cputype, int bank, u64 status, u64 misc)
+void i10nm_decode_model(int cputype, struct mce *m)
 {
+	int bank = m->bank;
+	u64 status = m->status, misc = m->misc;
 	enum banktype banktype;
 	u64 f;
 
@@ -19,17 +19,8 @@
 #include "mcelog.h"
 #include "intel.h"
 #include "bitfield.h"
-#include "nehalem.h"
 #include "memdb.h"
 #include "page.h"
-#include "sandy-bridge.h"
-#include "ivy-bridge.h"
-#include "haswell.h"
-#include "skylake_xeon.h"
-#include "i10nm.h"
-#include "sapphire.h"
-#include "granite.h"
-#include "diamond.h"
 
 int memory_error_support;
 
@@ -87,51 +78,32 @@ int is_intel_cpu(int cpu)
 	return cpu >= CPU_INTEL;
 }
 
-static int intel_memory_error(struct mce *m, unsigned recordlen)
+/* 
+ * Find channel/dimm of a memory controller error. Returns 0 when
+ * this is not a memory controller error.
+ */
+int intel_memerr_location(struct mce *m, int *channel, int *dimm)
 {
 	u32 mca = m->status & 0xffff;
-	if ((mca >> 7) == 1) { 
+
+	if ((mca >> 7) != 1)
+		return 0;
+
+	channel[0] = (mca & 0xf) == 0xf ? -1 : (int)(mca & 0xf);
+	channel[1] = -1;
+	dimm[0] = dimm[1] = -1;
+
+	if (cpu_ops[cputype].memerr_misc)
+		cpu_ops[cputype].memerr_misc(m, channel, dimm);
+	return 1;
+}
+
+static int intel_memory_error(struct mce *m, unsigned recordlen)
+{
+	int channel[2], dimm[2];
+
+	if (intel_memerr_location(m, channel, dimm)) { 
 		unsigned corr_err_cnt = 0;
-		int channel[2] = { (mca & 0xf) == 0xf ? -1 : (int)(mca & 0xf), -1 };
-		int dimm[2] = { -1, -1 };
-
-		switch (cputype) { 
-		case CPU_NEHALEM:
-			nehalem_memerr_misc(m, channel, dimm);
-			break;
-		case CPU_SANDY_BRIDGE_EP:
-			sandy_bridge_ep_memerr_misc(m, channel, dimm);
-			break;
-		case CPU_IVY_BRIDGE_EPEX:
-			ivy_bridge_ep_memerr_misc(m, channel, dimm);
-			break;
-		case CPU_HASWELL_EPEX:
-		case CPU_BROADWELL_EPEX:
-			haswell_memerr_misc(m, channel, dimm);
-			break;
-		case CPU_SKYLAKE_XEON:
-			skylake_memerr_misc(m, channel, dimm);
-			break;
-		case CPU_ICELAKE_XEON:
-		case CPU_ICELAKE_DE:
-		case CPU_TREMONT_D:
-			i10nm_memerr_misc(m, channel, dimm);
-			break;
-		case CPU_SAPPHIRERAPIDS:
-		case CPU_EMERALDRAPIDS:
-			sapphire_memerr_misc(m, channel, dimm);
-			break;
-		case CPU_GRANITERAPIDS:
-		case CPU_SIERRAFOREST:
-		case CPU_CLEARWATERFOREST:
-			granite_memerr_misc(m, channel, dimm);
-			break;
-		case CPU_DIAMONDRAPIDS:
-			diamond_memerr_misc(m, channel, dimm);
-			break;
-		default:
-			break;
-		} 
 
 		if (recordlen > offsetof(struct mce, mcgcap) && m->mcgcap & MCG_CMCI_P)
  			corr_err_cnt = EXTRACT(m->status, 38, 52);
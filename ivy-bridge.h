@@ -1,2 +1,2 @@
-void ivb_decode_model(int cputype, int bank, u64 status, u64 misc);
+void ivb_decode_model(int cputype, struct mce *m);
 void ivy_bridge_ep_memerr_misc(struct mce *m, int *channel, int *dimm);
@@ -257,7 +257,7 @@ void decode_k8_mc(struct mce *mce, int *ismemerr)
 
 char *k8_bank_name(unsigned num)
 { 
-	static char buf[64];
+	static __thread char buf[64];
 	char *s = "unknown";
 	if (num < NELE(k8bank))
 		s = k8bank[num];
@@ -26,22 +26,77 @@ time_t __attribute__((weak)) bucket_time(void)
 	return time(NULL);
 }
 
+/*
+ * Errors leaked in diff seconds, diff * rate / agetime rounded down, or
+ * limit if that is less. diff is at least agetime. Split diff at the
+ * agetime so the products stay below 2^64 once rate and the quotient are
+ * known to be below limit.
+ */
+static unsigned bucket_leak(unsigned long diff, unsigned agetime,
+			    unsigned long long rate, unsigned limit)
+{
+	unsigned long q = diff / agetime;
+	unsigned long r = diff % agetime;
+	unsigned long long leak;
+
+	if (rate == 0)
+		return 0;
+	if (q >= limit || rate >= limit)
+		return limit;
+	leak = q * rate + r * rate / agetime;
+	return leak < limit ? leak : limit;
+}
+
 void bucket_age(const struct bucket_conf *c, struct leaky_bucket *b,
 			time_t now, unsigned char capacity_multiplier)
 {
 	long diff;
 	diff = now - b->tstamp;
-	if (diff >= c->agetime) { 
-		unsigned age = (diff / (double)c->agetime) * c->capacity * capacity_multiplier;
+	if (c->agetime && diff >= c->agetime) { 
+		unsigned long long rate = (unsigned long long)c->capacity * capacity_multiplier;
+
 		b->tstamp = now;
-		if (age > b->count)
-			b->count = 0;
-		else
-			b->count -= age;
+		b->count -= bucket_leak(diff, c->agetime, rate, b->count);
 		b->excess = 0;
 	}
 }
 
+/* 
+ * Time from which aging empties the bucket, 0 if it is empty already.
+ * Until then the bucket has to be kept as it is.
+ */
+time_t bucket_drained(const struct bucket_conf *c, const struct leaky_bucket *b,
+		      unsigned char capacity_multiplier)
+{
+	unsigned long long rate = (unsigned long long)c->capacity * capacity_multiplier;
+	unsigned long long t;
+
+	if (rate == 0 || (b->count == 0 && b->excess == 0))
+		return 0;
+	t = ((unsigned long long)b->count * c->agetime + rate - 1) / rate;
+	if (t < c->agetime)
+		t = c->agetime;
+	return b->tstamp + t;
+}
+
+/* 
+ * Empty the bucket if aging at now would do so. The time stamp stays, so
+ * the next bucket_age gives the same result as without this.
+ * Returns 1 if the bucket is empty.
+ */
+int bucket_expire(const struct bucket_conf *c, struct leaky_bucket *b, 
+		  time_t now, unsigned char capacity_multiplier)
+{
+	struct leaky_bucket aged = *b;
+
+	bucket_age(c, &aged, now, capacity_multiplier);
+	if (aged.count != 0 || aged.excess != 0)
+		return 0;
+	b->count = 0;
+	b->excess = 0;
+	return 1;
+}
+
 /* Account increase in leaky bucket. Return 1 if bucket overflowed. */
 int __bucket_account(const struct bucket_conf *c, struct leaky_bucket *b, 
 		   unsigned inc, time_t t, unsigned char capacity_multiplier)
@@ -156,6 +211,9 @@ void bucket_init(struct leaky_bucket *b)
 
 
 #ifdef TEST_LEAKY_BUCKET
+#include <stdlib.h>
+#include <string.h>
+
 /* Stolen from the cpp documentation */
 #define xstr(_s) str(_s)
 #define str(_s) #_s
@@ -176,14 +234,20 @@ void bucket_init(struct leaky_bucket *b)
 #define TOTAL_SECONDS_FOR_TEST (PERIODS_TO_TEST * THRESHOLD_PERIOD)
 #define TOTAL_EVENTS (PERIODS_TO_TEST * EVENTS_PER_PERIOD_IN_TEST)
 
-int main(int argc, char **argv)
+/* 
+ * Account events at EVENTS_PER_LOGGED_EVENT times the threshold rate. The
+ * bucket overflows every THRESHOLD_EVENTS_PER_PERIOD events, aging only
+ * restarts the count at period boundaries. Then events at half the
+ * threshold rate must never overflow.
+ */
+static int selftest(void)
 {
 	struct bucket_conf c;
 	struct leaky_bucket b;
 	time_t start_time;
 	time_t event_time;
 	int ret;
-	int i;
+	int i, last = 0, logged = 0;
 
 #ifdef TEST_LEAKY_BUCKET_DEBUG
 	printf("Testing with a rate of " RATE_STRING "\n");
@@ -198,25 +262,120 @@ int main(int argc, char **argv)
 	for (i = 1; i <= TOTAL_EVENTS; i++) {
 		event_time = start_time + i * SECONDS_PER_EVENT;
 		ret = __bucket_account(&c, &b, 1, event_time, 1);
-
+		if (!ret)
+			continue;
 #ifdef TEST_LEAKY_BUCKET_DEBUG
-		if (ret)
-			printf("Logging entry %d at %ld %ld\n", i, event_time - start_time, b.tstamp);
-#else
-		if (i < THRESHOLD_EVENTS_PER_PERIOD) {
-			if (!ret){
-				fprintf(stderr, "Did not log initial events - FAIL.\n");
-				return -1;
-			}
-		} else {
-			if (!(i % EVENTS_PER_LOGGED_EVENT) && !ret) {
-				fprintf(stderr, "Did not log initial events - FAIL.\n");
-				return -1;
-			}
-		}
+		printf("Logging entry %d at %ld %ld\n", i, event_time - start_time, b.tstamp);
 #endif
+		if (i - last < THRESHOLD_EVENTS_PER_PERIOD) {
+			fprintf(stderr, "Logged entry %d only %d events after the last - FAIL.\n",
+				i, i - last);
+			return -1;
+		}
+		last = i;
+		logged++;
+	}
+	if (logged < TOTAL_EVENTS / THRESHOLD_EVENTS_PER_PERIOD - PERIODS_TO_TEST ||
+	    logged > TOTAL_EVENTS / THRESHOLD_EVENTS_PER_PERIOD) {
+		fprintf(stderr, "Logged %d entries for %d events - FAIL.\n",
+			logged, TOTAL_EVENTS);
+		return -1;
 	}
 
+	bucket_init(&b);
+	start_time = b.tstamp;
+	for (i = 1; i <= PERIODS_TO_TEST * THRESHOLD_EVENTS_PER_PERIOD / 2; i++) {
+		event_time = start_time + i * 2 * THRESHOLD_PERIOD / THRESHOLD_EVENTS_PER_PERIOD;
+		if (__bucket_account(&c, &b, 1, event_time, 1)) {
+			fprintf(stderr, "Logged entry %d below the threshold rate - FAIL.\n", i);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static unsigned long long rnd(unsigned long long max)
+{
+	unsigned long long v = ((unsigned long long)random() << 33) ^
+		((unsigned long long)random() << 2) ^ random();
+
+	/* Favour small values and the edges */
+	v >>= random() % 64;
+	return max ? v % (max + 1) : 0;
+}
+
+/* Compare bucket_age with exact arithmetic on random buckets */
+static int fuzz(unsigned long n)
+{
+	unsigned long i, fp_diff = 0;
+
+	srandom(1);
+	for (i = 0; i < n; i++) {
+		struct bucket_conf c = { .capacity = rnd(~0U), .agetime = rnd(~0U) };
+		unsigned char mult = rnd(255);
+		struct leaky_bucket b = { .count = rnd(~0U), .excess = rnd(~0U) };
+		long diff = rnd(1UL << 40);
+		unsigned __int128 age;
+		unsigned expect;
+		double fp;
+
+		if (c.agetime == 0)
+			continue;
+		if (random() & 1)
+			diff = c.agetime + rnd(c.agetime);
+		age = (unsigned __int128)diff * c.capacity * mult / c.agetime;
+		expect = diff < c.agetime ? b.count : 
+			age > b.count ? 0 : b.count - (unsigned)age;
+		fp = (diff / (double)c.agetime) * c.capacity * mult;
+		if (diff >= c.agetime && fp < b.count && (unsigned)fp != age)
+			fp_diff++;
+
+		b.tstamp = 1000;
+		bucket_age(&c, &b, b.tstamp + diff, mult);
+		if (b.count != expect) {
+			fprintf(stderr, "FAIL: %u/%u mult %u diff %ld: %u, expected %u\n",
+				c.capacity, c.agetime, mult, diff, b.count, expect);
+			return -1;
+		}
+	}
+	printf("%lu buckets ok, floating point was off in %lu\n", n, fp_diff);
 	return 0;
 }
+
+static int bench(unsigned long n)
+{
+	struct bucket_conf c;
+	struct leaky_bucket b;
+	struct timespec start, end;
+	unsigned long i, over = 0;
+	long long ns;
+
+	bucket_conf_init(&c, "100 / 1h");
+	bucket_init(&b);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < n; i++)
+		over += __bucket_account(&c, &b, 1, b.tstamp + (i & 63), 1);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ns = (end.tv_sec - start.tv_sec) * 1000000000LL + end.tv_nsec - start.tv_nsec;
+	printf("%lu accounts in %lld us, %.1f ns each, %lu overflows\n",
+	       n, ns / 1000, (double)ns / n, over);
+	return 0;
+}
+
+/*
+ * leaky-bucket-test		threshold self test
+ * leaky-bucket-test fuzz [n]	compare aging with exact arithmetic
+ * leaky-bucket-test bench [n]	time accounting
+ */
+int main(int argc, char **argv)
+{
+	unsigned long n = argc > 2 ? strtoul(argv[2], NULL, 0) : 10000000;
+
+	if (argc > 1 && !strcmp(argv[1], "fuzz"))
+		return fuzz(n);
+	if (argc > 1 && !strcmp(argv[1], "bench"))
+		return bench(n);
+	return selftest();
+}
 #endif
@@ -30,5 +30,9 @@ void bucket_init(struct leaky_bucket *b);
 time_t bucket_time(void);
 void bucket_age(const struct bucket_conf *c, struct leaky_bucket *b,
 			time_t now, unsigned char capacity_multiplier);
+time_t bucket_drained(const struct bucket_conf *c, const struct leaky_bucket *b,
+		      unsigned char capacity_multiplier);
+int bucket_expire(const struct bucket_conf *c, struct leaky_bucket *b, 
+		  time_t now, unsigned char capacity_multiplier);
 
 #endif
@@ -20,8 +20,11 @@
 #define _GNU_SOURCE 1
 #include <sys/fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <asm/types.h>
 #include <asm/ioctls.h>
+#include <limits.h>
 #include <linux/limits.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -58,8 +61,13 @@
 #include "page.h"
 #include "bus.h"
 #include "unknown.h"
+#include "record.h"
+#include "diskdb.h"
+#include "parallel.h"
+#include "timewheel.h"
+#include "statsfile.h"
 
-enum cputype cputype = CPU_GENERIC;	
+__thread enum cputype cputype = CPU_GENERIC;	
 
 char *logfn = LOG_DEV_FILENAME; 
 
@@ -97,7 +105,7 @@ static void disclaimer(void)
 
 static char *extended_bankname(unsigned bank) 
 {
-	static char buf[64];
+	static __thread char buf[64];
 	switch (bank) { 
 	case MCE_THERMAL_BANK:
 		return "THERMAL EVENT";
@@ -119,14 +127,12 @@ static char *extended_bankname(unsigned bank)
 
 static char *bankname(unsigned bank) 
 { 
-	static char numeric[64];
+	static __thread char numeric[64];
 	if (bank >= MCE_EXTENDED_BANK) 
 		return extended_bankname(bank);
 
-	if (cputype >= CPU_INTEL)
-		return intel_bank_name(bank);
-	else if (cputype == CPU_K8)
-		return k8_bank_name(bank);
+	if (cpu_ops[cputype].bank_name)
+		return cpu_ops[cputype].bank_name(bank);
 
 	/* add banks of other cpu types here */
 	sprintf(numeric, "BANK %d", bank);
@@ -204,6 +210,7 @@ static u32 unparse_cpuid(unsigned family, unsigned model)
 		u32 v;	
        } c;
 
+	c.v = 0;
 	c.c.family = family;
 	if (family >= 0xf) {
 		c.c.family = 0xf;
@@ -321,6 +328,7 @@ static void dump_mce(struct mce *m, unsigned recordlen)
 	int ismemerr = 0;
 	unsigned cpu = m->extcpu ? m->extcpu : m->cpu;
 
+	record_begin(m, recordlen);
 	/* should not happen */
 	if (!m->finished)
 		Wprintf("not finished?\n");
@@ -341,10 +349,14 @@ static void dump_mce(struct mce *m, unsigned recordlen)
 		Wprintf("\n");
 	if (m->time) {
 		time_t t = m->time;
-		Wprintf("TIME %llu %s", m->time, ctime(&t));
+		char tbuf[32];
+		Wprintf("TIME %llu %s", m->time, ctime_r(&t, tbuf));
 	} 
-	if (cputype == CPU_K8)
+	if (cputype == CPU_K8) {
+		record_text_begin();
 		decode_k8_mc(m, &ismemerr); 
+		record_text_end(REC_MCA_TEXT);
+	}
 	else if (cputype >= CPU_INTEL)
 		decode_intel_mc(m, cputype, &ismemerr, recordlen);
 	/* else add handlers for other CPUs here */
@@ -376,12 +388,9 @@ static void dump_mce(struct mce *m, unsigned recordlen)
 			mod,
 			step);
 	}
-	if (cputype == CPU_ATOM || cputype == CPU_CORE2 || cputype == CPU_DUNNINGTON ||
-	    cputype == CPU_GENERIC || cputype == CPU_HASWELL || cputype == CPU_ICELAKE ||
-	    cputype == CPU_INTEL || cputype == CPU_IVY_BRIDGE || cputype == CPU_K8 ||
-	    cputype == CPU_NEHALEM || cputype == CPU_P4 || cputype == CPU_P6OLD ||
-	    cputype == CPU_SANDY_BRIDGE || cputype == CPU_TULSA || cputype == CPU_XEON75XX)
+	if (cpu_ops[cputype].flags & OPS_RESOLVEADDR)
 		resolveaddr(m->addr);
+	record_end();
 }
 
 static void dump_mce_raw_ascii(struct mce *m, unsigned recordlen)
@@ -492,6 +501,137 @@ static char *skipspace(char *s)
 	return s;
 }
 
+/*
+ * Scanners for the fields of decodefatal's input. They follow the
+ * sscanf conversions they replace: leading white space is skipped, the
+ * number may have a sign and for hex a 0x prefix, a width limits the
+ * characters read (0 means no limit) and overflow saturates like strtoull.
+ * On success the pointer is advanced past the conversion and the value
+ * stored, on failure neither is touched.
+ */
+
+static inline unsigned digitval(int c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c |= 0x20;
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return 16;
+}
+
+static int scan_digits(char **sp, unsigned base, int width, 
+		       unsigned long long *val, int *neg)
+{
+	char *s = skipspace(*sp);
+	unsigned long long v = 0;
+	int overflow = 0, digits = 0;
+	unsigned d;
+
+	if (width == 0)
+		width = -1;
+	*neg = 0;
+	if (width != 0 && (*s == '-' || *s == '+')) {
+		*neg = *s++ == '-';
+		width--;
+	}
+	if (width != 0 && *s == '0') {
+		s++;
+		width--;
+		digits++;
+		if (base == 16 && width != 0 && (*s | 0x20) == 'x') {
+			s++;
+			width--;
+		}
+	}
+	for (; width != 0 && (d = digitval(*s)) < base; s++, width--) {
+		if (v > (~0ULL - d) / base)
+			overflow = 1;
+		v = v * base + d;
+		digits++;
+	}
+	if (!digits)
+		return 0;
+	if (overflow)
+		v = ~0ULL;
+	*val = v;
+	*sp = s;
+	return 1;
+}
+
+/* %llx, %llu, %x, %u */
+static int scan_u64(char **sp, unsigned base, int width, unsigned long long *val)
+{
+	unsigned long long v;
+	int neg;
+
+	if (!scan_digits(sp, base, width, &v, &neg))
+		return 0;
+	*val = neg && v != ~0ULL ? -v : v;
+	return 1;
+}
+
+/* %d, which converts with strtol */
+static int scan_int(char **sp, int *val)
+{
+	unsigned long long v;
+	long l;
+	int neg;
+
+	if (!scan_digits(sp, 10, 0, &v, &neg))
+		return 0;
+	if (neg)
+		l = v > (unsigned long long)LONG_MAX + 1 ? LONG_MIN : -(long long)v;
+	else
+		l = v > LONG_MAX ? LONG_MAX : (long)v;
+	*val = l;
+	return 1;
+}
+
+/* %Ns: a word of up to max characters */
+static int scan_word(char **sp, char *buf, int max)
+{
+	char *s = skipspace(*sp);
+	int n;
+
+	for (n = 0; n < max && s[n] && !isspace(s[n]); n++)
+		buf[n] = s[n];
+	if (n == 0)
+		return 0;
+	buf[n] = '\0';
+	*sp = s + n;
+	return 1;
+}
+
+/* Literal text where a blank matches any amount of white space */
+static int scan_lit(char **sp, const char *lit)
+{
+	char *s = *sp;
+
+	for (; *lit; lit++) {
+		if (*lit == ' ')
+			s = skipspace(s);
+		else if (*s == *lit)
+			s++;
+		else
+			return 0;
+	}
+	*sp = s;
+	return 1;
+}
+
+/* "KEY %llx%n" and friends */
+static int scan_key(char *s, const char *key, unsigned base, 
+		    unsigned long long *val, int *next)
+{
+	char *p = s;
+
+	if (!scan_lit(&p, key) || !scan_u64(&p, base, 0, val))
+		return 0;
+	*next = p - s;
+	return 1;
+}
+
 static char *skip_syslog(char *s)
 {
 	char *p;
@@ -548,9 +688,21 @@ static unsigned skip_date(char *s)
 	char month[11];
 	unsigned next;
 
-	if (sscanf(s, "%10s %10s %u %u:%u:%u %u%n", 
-		dayname, month, &day, &hour, &min, &sec, &year, &next) != 7)
+	unsigned long long v[5];
+	char *p = s;
+
+	if (!scan_word(&p, dayname, 10) || !scan_word(&p, month, 10) ||
+	    !scan_u64(&p, 10, 0, &v[0]) || !scan_u64(&p, 10, 0, &v[1]) ||
+	    !scan_lit(&p, ":") || !scan_u64(&p, 10, 0, &v[2]) ||
+	    !scan_lit(&p, ":") || !scan_u64(&p, 10, 0, &v[3]) ||
+	    !scan_u64(&p, 10, 0, &v[4]))
 		return 0;
+	day = v[0];
+	hour = v[1];
+	min = v[2];
+	sec = v[3];
+	year = v[4];
+	next = p - s;
 	if (!is_short(dayname) || !is_short(month) || !urange(day, 1, 31) ||
 		!urange(hour, 0, 24) || !urange(min, 0, 59) || !urange(sec, 0, 59) ||
 		year < 1900)
@@ -558,12 +710,34 @@ static unsigned skip_date(char *s)
 	return next;
 }
 
-static void dump_mce_final(struct mce *m, char *symbol, int missing, int recordlen, 
-			   int dseen)
+/* A record or a line of text queued for parallel decoding */
+struct decode_item {
+	struct mce m;
+	enum cputype cputype;
+	unsigned recordlen;
+	int index;
+	char *text;		/* copy this line to the output */
+	int missing;
+	int dseen;
+	char symbol[100];
+};
+
+static int parallel_decode;
+
+/* Decode in parallel when the output only goes to the log stream */
+static void parallel_setup(void)
+{
+	if (parallel_jobs == 0)
+		parallel_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	if (parallel_jobs <= 1 ||
+	    (syslog_opt & SYSLOG_LOG) || (do_dmi && dmi_forced))
+		return;
+	parallel_decode = 1;
+}
+
+static void print_mce_final(struct mce *m, char *symbol, int missing, int recordlen,
+			    int dseen)
 {
-	m->finished = 1;
-	if (m->cpuid)
-		mce_cpuid(m);
 	if (!dump_raw_ascii) {
 		if (!dseen)
 			disclaimer();
@@ -575,6 +749,55 @@ static void dump_mce_final(struct mce *m, char *symbol, int missing, int recordl
 	} else
 		dump_mce_raw_ascii(m, recordlen);
 	flushlog();
+	record_flush();
+}
+
+static void decode_ascii_item(void *p)
+{
+	struct decode_item *it = p;
+
+	if (it->text) {
+		Wprintf("%s", it->text);
+		free(it->text);
+		return;
+	}
+	cputype = it->cputype;
+	print_mce_final(&it->m, it->symbol, it->missing, it->recordlen, it->dseen);
+}
+
+/* The CPU type is tracked in input order, only the decoding is parallel */
+static void dump_mce_final(struct mce *m, char *symbol, int missing, int recordlen, 
+			   int dseen)
+{
+	struct decode_item *it;
+
+	m->finished = 1;
+	if (m->cpuid)
+		mce_cpuid(m);
+	if (!parallel_decode) {
+		print_mce_final(m, symbol, missing, recordlen, dseen);
+		return;
+	}
+	it = parallel_item();
+	it->m = *m;
+	it->cputype = cputype;
+	it->recordlen = recordlen;
+	it->text = NULL;
+	it->missing = missing;
+	it->dseen = dseen;
+	strcpy(it->symbol, symbol);
+}
+
+static void copy_line(char *s)
+{
+	struct decode_item *it;
+
+	if (!parallel_decode) {
+		Wprintf("%s", s);
+		return;
+	}
+	it = parallel_item();
+	it->text = xstrdup(s);
 }
 
 static char *skip_patterns[] = {
@@ -586,38 +809,188 @@ static char *skip_patterns[] = {
 	NULL
 };
 
+/* All patterns start with a literal character */
 static int match_patterns(char *s, char **pat)
 {
 	for (; *pat; pat++) 
-		if (!fnmatch(*pat, s, 0))
+		if (**pat == *s && !fnmatch(*pat, s, 0))
 			return 0;
 	return 1;
 }
 
+enum ascii_key {
+	K_NONE, K_CPU, K_STATUS, K_MCGSTATUS, K_RIP, K_TSC, K_ADDR, K_MISC,
+	K_PROCESSOR, K_TIME, K_MCGCAP, K_APICID, K_SOCKETID, K_CPUID
+};
+
+/* Classify an input line by its leading keyword */
+static enum ascii_key ascii_keyword(char *s)
+{
+	switch (s[0]) {
+	case 'A':
+		if (!strncmp(s, "ADDR", 4))
+			return K_ADDR;
+		if (!strncmp(s, "APICID", 6))
+			return K_APICID;
+		break;
+	case 'C':
+		if (!strncmp(s, "CPU ", 4))
+			return K_CPU;
+		if (!strncmp(s, "CPUID", 5))
+			return K_CPUID;
+		break;
+	case 'M':
+		if (!strncmp(s, "MCGSTA", 6))
+			return K_MCGSTATUS;
+		if (!strncmp(s, "MISC", 4))
+			return K_MISC;
+		if (!strncmp(s, "MCGCAP", 6))
+			return K_MCGCAP;
+		break;
+	case 'P':
+		if (!strncmp(s, "PROCESSOR", 9))
+			return K_PROCESSOR;
+		break;
+	case 'R':
+		if (!strncmp(s, "RIP", 3))
+			return K_RIP;
+		break;
+	case 'S':
+		if (!strncmp(s, "STATUS", 6))
+			return K_STATUS;
+		if (!strncmp(s, "SOCKETID", 8))
+			return K_SOCKETID;
+		break;
+	case 'T':
+		if (!strncmp(s, "TSC", 3))
+			return K_TSC;
+		if (!strncmp(s, "TIME", 4))
+			return K_TIME;
+		break;
+	}
+	return K_NONE;
+}
+
+/* %*[ :Ec-x] */
+static int scan_mcheck(char **sp)
+{
+	char *s = *sp;
+
+	while (*s == ' ' || *s == ':' || *s == 'E' || (*s >= 'c' && *s <= 'x'))
+		s++;
+	if (s == *sp)
+		return 0;
+	*sp = s;
+	return 1;
+}
+
 #define FIELD(f) \
 	if (recordlen < endof_field(struct mce, f)) \
 		recordlen = endof_field(struct mce, f)
 
+/* 
+ * Line reader for decodefatal. The input is read in large blocks and the
+ * lines are handed out in place, which keeps a pipe from gzip or a huge
+ * log file streaming without a copy or a stdio call per line.
+ */
+#define LINEBUF_SIZE (1024*1024)
+
+struct linebuf {
+	int fd;
+	char *buf;
+	size_t size;
+	size_t start, end;	/* unconsumed input */
+	char *term;		/* where the current line is terminated */
+	char saved;		/* byte overwritten by the terminator */
+	int eof;
+};
+
+static void linebuf_init(struct linebuf *lb, int fd)
+{
+	memset(lb, 0, sizeof(struct linebuf));
+	lb->fd = fd;
+	lb->size = LINEBUF_SIZE;
+	lb->buf = xalloc_nonzero(lb->size + 1);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+static void linebuf_free(struct linebuf *lb)
+{
+	free(lb->buf);
+	lb->buf = NULL;
+}
+
+/* 
+ * Return the next line including the newline as a string, or NULL at the
+ * end of the input. The line is valid until the next call.
+ */
+static char *linebuf_next(struct linebuf *lb)
+{
+	char *line, *nl;
+	ssize_t n;
+
+	if (lb->term) {
+		*lb->term = lb->saved;
+		lb->term = NULL;
+	}
+	for (;;) {
+		line = lb->buf + lb->start;
+		nl = memchr(line, '\n', lb->end - lb->start);
+		if (nl || (lb->eof && lb->start < lb->end)) {
+			nl = nl ? nl + 1 : lb->buf + lb->end;
+			lb->start = nl - lb->buf;
+			lb->term = nl;
+			lb->saved = *nl;
+			*nl = '\0';
+			return line;
+		}
+		if (lb->eof)
+			return NULL;
+
+		/* Move the partial line to the front, grow for very long lines */
+		if (lb->start > 0) {
+			memmove(lb->buf, line, lb->end - lb->start);
+			lb->end -= lb->start;
+			lb->start = 0;
+		} else if (lb->end == lb->size) {
+			lb->size *= 2;
+			lb->buf = xrealloc(lb->buf, lb->size + 1);
+		}
+		n = read(lb->fd, lb->buf + lb->end, lb->size - lb->end);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			SYSERRprintf("read error on input");
+		if (n <= 0)
+			lb->eof = 1;
+		else
+			lb->end += n;
+	}
+}
+
 /* Decode ASCII input for fatal messages */
-static void decodefatal(FILE *inf)
+static void decodefatal(int fd)
 {
 	struct mce m;
-	char *line = NULL; 
-	size_t linelen = 0;
+	struct linebuf lb;
+	char *line;
 	int missing; 
 	char symbol[100];
 	int data;
 	int next;
 	char *s = NULL;
-	unsigned cpuvendor;
 	unsigned recordlen;
 	int disclaimer_seen;
+	enum ascii_key key;
 
 	ascii_mode = 1;
 	if (do_dmi && dmi_forced)
 		Wprintf(
  "WARNING: with --dmi mcelog --ascii must run on the same machine with the\n"
  "     same BIOS/memory configuration as where the machine check occurred.\n");
+	if (parallel_decode)
+		parallel_start(decode_ascii_item, sizeof(struct decode_item));
+	linebuf_init(&lb, fd);
 
 restart:
 	missing = 0;
@@ -627,7 +1000,7 @@ restart:
 	recordlen = 0;
 	memset(&m, 0, sizeof(struct mce));
 	symbol[0] = '\0';
-	while (next > 0 || getdelim(&line, &linelen, '\n', inf) > 0) { 
+	while (next > 0 || (line = linebuf_next(&lb)) != NULL) { 
 		int n = 0;
 		char *start;
 
@@ -636,26 +1009,45 @@ restart:
 		start = s;
 		next = 0;
 
-		if (!strncmp(s, "CPU ", 4)) { 
-			unsigned cpu = 0, bank = 0;
-			n = sscanf(s,
-	       "CPU %u: Machine Check%*[ :Ec-x]%16Lx Bank %d: %016Lx%n",
-				   &cpu,
-				   &m.mcgstatus,
-				   &bank,
-				   &m.status,
-				   &next);
+		key = ascii_keyword(s);
+		if (key == K_CPU) { 
+			unsigned long long cpu = 0, bank2 = 0;
+			int bank = 0;
+			char *p = s;
+
+			/* "CPU %u: Machine Check%*[ :Ec-x]%16Lx Bank %d: %016Lx" */
+			if (scan_lit(&p, "CPU ") && scan_u64(&p, 10, 0, &cpu)) {
+				n = 1;
+				if (scan_lit(&p, ": Machine Check") && 
+				    scan_mcheck(&p) &&
+				    scan_u64(&p, 16, 16, &m.mcgstatus)) {
+					n = 2;
+					if (scan_lit(&p, " Bank ") &&
+					    scan_int(&p, &bank)) {
+						n = 3;
+						if (scan_lit(&p, ": ") &&
+						    scan_u64(&p, 16, 16, &m.status)) {
+							n = 4;
+							next = p - s;
+						}
+					}
+				}
+			}
 			if (n == 1) {
-				n = sscanf(s, "CPU %u BANK %u%n", &cpu, &bank, 
-						&next);
-				if (n != 2)
-					n = sscanf(s, "CPU %u %u%n", &cpu,
-						 &bank, &next);
+				/* "CPU %u BANK %u" or "CPU %u %u" */
+				p = s;
+				scan_lit(&p, "CPU ");
+				scan_u64(&p, 10, 0, &cpu);
+				scan_lit(&p, " BANK ");
+				if (scan_u64(&p, 10, 0, &bank2)) {
+					n = 2;
+					next = p - s;
+				}
 				m.cpu = cpu;
 				if (n < 2) 
 					missing++;
 				else { 
-					m.bank = bank;
+					m.bank = bank2;
 					FIELD(bank);
 				}
 			} else if (n <= 0) { 
@@ -673,95 +1065,142 @@ restart:
 					missing++; 
 			}
 		} 
-		else if (!strncmp(s, "STATUS", 6)) {
-			if ((n = sscanf(s,"STATUS %llx%n", &m.status, &next)) < 1)
+		else if (key == K_STATUS) {
+			if ((n = scan_key(s, "STATUS ", 16, &m.status, &next)) < 1)
 				missing++;
 			else
 				FIELD(status);
 		}
-		else if (!strncmp(s, "MCGSTATUS", 6)) {
-			if ((n = sscanf(s,"MCGSTATUS %llx%n", &m.mcgstatus, &next)) < 1)
+		else if (key == K_MCGSTATUS) {
+			if ((n = scan_key(s, "MCGSTATUS ", 16, &m.mcgstatus, &next)) < 1)
 				missing++;
 			else
 				FIELD(mcgstatus);
 		}
-		else if (!strncmp(s, "RIP", 3)) { 
-			unsigned cs = 0; 
+		else if (key == K_RIP) { 
+			unsigned long long cs = 0, ip;
+			char *p;
 
 			if (!strncmp(s, "RIP !INEXACT!", 13))
 				s += 13; 
 			else
 				s += 3; 
 
-			n = sscanf(s, "%02x:<%016Lx> {%99s}%n",
-				   &cs,
-				   &m.ip, 
-				   symbol, &next); 
+			/* "%02x:<%016Lx> {%99s}" */
+			p = s;
+			if (scan_u64(&p, 16, 2, &cs)) {
+				n = 1;
+				if (scan_lit(&p, ":<") &&
+				    scan_u64(&p, 16, 16, &ip)) {
+					n = 2;
+					m.ip = ip;
+					if (scan_lit(&p, "> {") &&
+					    scan_word(&p, symbol, 99)) {
+						n = 3;
+						if (scan_lit(&p, "}"))
+							next = p - s;
+					}
+				}
+			}
 			m.cs = cs;
 			if (n < 2) 
 				missing++; 
 			else
 				FIELD(ip);
 		} 
-		else if (!strncmp(s, "TSC",3)) { 
-			if ((n = sscanf(s, "TSC %llx%n", &m.tsc, &next)) < 1) 
+		else if (key == K_TSC) { 
+			if ((n = scan_key(s, "TSC ", 16, &m.tsc, &next)) < 1) 
 				missing++;
 			else
 				FIELD(tsc);
 		}
-		else if (!strncmp(s, "ADDR",4)) { 
-			if ((n = sscanf(s, "ADDR %llx%n", &m.addr, &next)) < 1) 
+		else if (key == K_ADDR) { 
+			if ((n = scan_key(s, "ADDR ", 16, &m.addr, &next)) < 1) 
 				missing++;
 			else
 				FIELD(addr);
 		}
-		else if (!strncmp(s, "MISC",4)) { 
-			if ((n = sscanf(s, "MISC %llx%n", &m.misc, &next)) < 1) 
+		else if (key == K_MISC) { 
+			if ((n = scan_key(s, "MISC ", 16, &m.misc, &next)) < 1) 
 				missing++; 
 			else
 				FIELD(misc);
 		} 
-		else if (!strncmp(s, "PROCESSOR", 9)) { 
-			if ((n = sscanf(s, "PROCESSOR %u:%x%n", &cpuvendor, &m.cpuid, &next)) < 2)
+		else if (key == K_PROCESSOR) { 
+			unsigned long long cpuvendor, cpuid;
+			char *p = s;
+
+			/* "PROCESSOR %u:%x" */
+			if (scan_lit(&p, "PROCESSOR ") && 
+			    scan_u64(&p, 10, 0, &cpuvendor)) {
+				n = 1;
+				if (scan_lit(&p, ":") && 
+				    scan_u64(&p, 16, 0, &cpuid)) {
+					n = 2;
+					next = p - s;
+				}
+			}
+			if (n < 2)
 				missing++;
 			else {
 				m.cpuvendor = cpuvendor;			
+				m.cpuid = cpuid;
 				FIELD(cpuid);
 				FIELD(cpuvendor);
 			}
 		} 
-		else if (!strncmp(s, "TIME", 4)) { 
-			if ((n = sscanf(s, "TIME %llu%n", &m.time, &next)) < 1)
+		else if (key == K_TIME) { 
+			if ((n = scan_key(s, "TIME ", 10, &m.time, &next)) < 1)
 				missing++;
 			else
 				FIELD(time);
 
 			next += skip_date(s + next);
 		} 
-		else if (!strncmp(s, "MCGCAP", 6)) {
-			if ((n = sscanf(s, "MCGCAP %llx%n", &m.mcgcap, &next)) != 1)
+		else if (key == K_MCGCAP) {
+			if ((n = scan_key(s, "MCGCAP ", 16, &m.mcgcap, &next)) != 1)
 				missing++;
 			else
 				FIELD(mcgcap);
 		} 
-		else if (!strncmp(s, "APICID", 6)) {
-			if ((n = sscanf(s, "APICID %x%n", &m.apicid, &next)) != 1)
+		else if (key == K_APICID) {
+			unsigned long long apicid;
+
+			if ((n = scan_key(s, "APICID ", 16, &apicid, &next)) != 1)
 				missing++;
-			else
+			else {
+				m.apicid = apicid;
 				FIELD(apicid);
+			}
 		} 
-		else if (!strncmp(s, "SOCKETID", 8)) {
-			if ((n = sscanf(s, "SOCKETID %u%n", &m.socketid, &next)) != 1)
+		else if (key == K_SOCKETID) {
+			unsigned long long socketid;
+
+			if ((n = scan_key(s, "SOCKETID ", 10, &socketid, &next)) != 1)
 				missing++;
-			else
+			else {
+				m.socketid = socketid;
 				FIELD(socketid);
+			}
 		} 
-		else if (!strncmp(s, "CPUID", 5)) {
-			unsigned fam, mod;
+		else if (key == K_CPUID) {
+			unsigned long long fam, mod;
 			char vendor[31];
-
-			if ((n = sscanf(s, "CPUID Vendor %30s Family %u Model %u\n", 
-					vendor, &fam, &mod)) < 3)
+			char *p = s;
+
+			/* "CPUID Vendor %30s Family %u Model %u" */
+			if (scan_lit(&p, "CPUID Vendor ") &&
+			    scan_word(&p, vendor, 30)) {
+				n = 1;
+				if (scan_lit(&p, " Family ") &&
+				    scan_u64(&p, 10, 0, &fam)) {
+					n = 2;
+					if (scan_lit(&p, " Model ") &&
+					    scan_u64(&p, 10, 0, &mod))
+						n = 3;
+				}
+			}
+			if (n < 3)
 				missing++;
 			else {
 				m.cpuvendor = cpuvendor_to_num(vendor);
@@ -799,17 +1238,18 @@ restart:
 			if (*s && data)
 				dump_mce_final(&m, symbol, missing, recordlen, disclaimer_seen); 
 			if (!dump_raw_ascii)
-				Wprintf("%s", start);
+				copy_line(start);
 			if (*s && data)
 				goto restart;
 		} 
 		if (n > 0) 
 			data = 1;
 	} 
-	free(line);
-	line = NULL;
+	linebuf_free(&lb);
 	if (data)
 		dump_mce_final(&m, symbol, missing, recordlen, disclaimer_seen);
+	if (parallel_decode)
+		parallel_finish();
 }
 
 static void remove_pidfile(void)
@@ -849,9 +1289,9 @@ static void write_pidfile(void)
 {
 	FILE *f;
 	atexit(remove_pidfile);
-	signal(SIGTERM, signal_exit);
-	signal(SIGINT, signal_exit);
-	signal(SIGQUIT, signal_exit);
+	register_signalcb(SIGTERM, signal_exit);
+	register_signalcb(SIGINT, signal_exit);
+	register_signalcb(SIGQUIT, signal_exit);
 	f = fopen(pidfile, "w");
 	if (!f) {
 		Eprintf("Cannot open pidfile `%s'", pidfile);
@@ -891,6 +1331,7 @@ void usage(void)
 "--raw               (with --ascii) Dump in raw ASCII format for machine processing\n"
 "--daemon            Run in background waiting for events (needs newer kernel)\n"
 "--client            Query a currently running mcelog daemon for errors\n"
+"                    (with --binary) using the binary protocol\n"
 "--ping              Send ping command to the currently running mcelog daemon\n"
 "--ignorenodev       Exit silently when the device cannot be opened\n"
 "--file filename     With --ascii read machine check log from filename instead of stdin\n"
@@ -912,8 +1353,13 @@ void usage(void)
 "--is-cpu-supported  Exit with return code indicating whether the CPU is supported\n"
 "--max-corr-err-counters Max page correctable error counters\n"
 "--binary            Input is binary (e.g. from pstore)\n"
+"--record FORMAT     Write structured records in FORMAT (json or binary)\n"
+"--record-file filename Write structured records to filename instead of stdout\n"
+"--jobs N            Decode --ascii or --binary input on N threads (0: one per CPU)\n"
 "--help              Display this message.\n"
 		);
+	diskdb_usage();
+	statsfile_usage();
 	printf("\n");
 	print_cputypes();
 }
@@ -951,6 +1397,9 @@ enum options {
 	O_MAX_CORR_ERR_COUNTERS,
 	O_HELP,
 	O_BINARY,
+	O_RECORD,
+	O_RECORD_FILE,
+	O_JOBS,
 };
 
 static struct option options[] = {
@@ -988,7 +1437,12 @@ static struct option options[] = {
 	{ "max-corr-err-counters", 1, NULL, O_MAX_CORR_ERR_COUNTERS },
 	{ "help", 0, NULL, O_HELP },
 	{ "binary", 0, NULL, O_BINARY },
+	{ "record", 1, NULL, O_RECORD },
+	{ "record-file", 1, NULL, O_RECORD_FILE },
+	{ "jobs", 1, NULL, O_JOBS },
 	{ "is-cpu-supported", 0, NULL, O_IS_CPU_SUPPORTED },
+	DISKDB_OPTIONS
+	STATSFILE_OPTIONS
 	{}
 };
 
@@ -1107,6 +1561,18 @@ static int modifier(int opt)
 		usage();
 		exit(0);
 		break;
+	case O_RECORD:
+		if (record_set_format(optarg) < 0) {
+			usage();
+			exit(1);
+		}
+		break;
+	case O_RECORD_FILE:
+		record_file = optarg;
+		break;
+	case O_JOBS:
+		parallel_jobs = atoi(optarg);
+		break;
 	case O_BINARY:
 		binary_file = true;
 	case 0:
@@ -1154,6 +1620,10 @@ void no_syslog(void)
 static int combined_modifier(int opt)
 {
 	int r = modifier(opt);
+	if (r == 0)
+		r = diskdb_modifier(opt);
+	if (r == 0)
+		r = statsfile_modifier(opt);
 	return r;
 }
 
@@ -1185,6 +1655,68 @@ static void drop_cred(void)
 	}
 }
 
+static void print_mce(struct mce *mce, int i, unsigned recordlen)
+{
+	if (!dump_raw_ascii) {
+		disclaimer();
+		Wprintf("MCE %d\n", i);
+		dump_mce(mce, recordlen);
+	} else
+		dump_mce_raw_ascii(mce, recordlen);
+}
+
+static void decode_binary_item(void *p)
+{
+	struct decode_item *it = p;
+
+	cputype = it->cputype;
+	print_mce(&it->m, it->index, it->recordlen);
+}
+
+/* Decode one record. Returns 1 when enough errors were processed */
+static int process_mce(struct mce *mce, int i, unsigned recordlen)
+{
+	struct decode_item *it;
+	int finish = 0;
+
+	mce_prepare(mce);
+	if (numerrors > 0 && --numerrors == 0)
+		finish = 1;
+	/* The filter already accounts memory errors, their thresholds follow the MCE */
+	server_hold_events();
+	if (!mce_filter(mce, recordlen)) {
+		server_release_events();
+		return finish;
+	}
+	server_publish_mce(mce);
+	server_release_events();
+	if (!parallel_decode) {
+		print_mce(mce, i, recordlen);
+		return finish;
+	}
+	it = parallel_item();
+	it->m = *mce;
+	it->cputype = cputype;
+	it->recordlen = recordlen;
+	it->index = i;
+	return finish;
+}
+
+static void process_finish(int finish, unsigned recordlen)
+{
+	if (debug_numerrors && numerrors <= 0)
+		finish = 1;
+
+	if (recordlen > sizeof(struct mce))  {
+		Eprintf("warning: %lu bytes ignored in each record\n",
+				(unsigned long)recordlen - sizeof(struct mce)); 
+		Eprintf("consider an update\n"); 
+	}
+
+	if (finish)
+		exit(0);
+}
+
 static void process(int fd, unsigned recordlen, unsigned loglen, char *buf)
 {	
 	int i; 
@@ -1209,33 +1741,70 @@ static void process(int fd, unsigned recordlen, unsigned loglen, char *buf)
 			Eprintf("Warning: MCE buffer is overflowed.\n");
 	}
 
-	for (i = 0; (i < count) && !finish; i++) {
-		struct mce *mce = (struct mce *)(buf + i*recordlen);
-		mce_prepare(mce);
-		if (numerrors > 0 && --numerrors == 0)
-			finish = 1;
-		if (!mce_filter(mce, recordlen)) 
-			continue;
-		if (!dump_raw_ascii) {
-			disclaimer();
-			Wprintf("MCE %d\n", i);
-			dump_mce(mce, recordlen);
-		} else
-			dump_mce_raw_ascii(mce, recordlen);
-		flushlog();
-	}
+	/* Decode the whole read into one buffer and write it out at once */
+	startbatch();
+	for (i = 0; (i < count) && !finish; i++)
+		finish = process_mce((struct mce *)(buf + i*recordlen), i, recordlen);
+	flushbatch();
+	record_flush();
+	process_finish(finish, recordlen);
+}
 
-	if (debug_numerrors && numerrors <= 0)
-		finish = 1;
+/* 
+ * Decode a binary capture in place. A file that is a multiple of the record
+ * size holds a sequence of records, anything else is a single record (like
+ * a pstore file written by a different kernel). Only one record is copied
+ * at a time and the decoded output is flushed and the mapping dropped in
+ * chunks, so memory use does not depend on the size of the capture.
+ */
+#define BINARY_CHUNK (1UL << 20)
 
-	if (recordlen > sizeof(struct mce))  {
-		Eprintf("warning: %lu bytes ignored in each record\n",
-				(unsigned long)recordlen - sizeof(struct mce)); 
-		Eprintf("consider an update\n"); 
+static void process_binary(int fd)
+{
+	struct stat st;
+	struct mce m;
+	size_t size, off, done = 0, recordlen, copy;
+	char *map;
+	int i, finish = 0;
+
+	if (fstat(fd, &st) < 0)
+		err("fstat");
+	size = st.st_size;
+	if (size == 0) {
+		Wprintf("no data in mce record\n");
+		return;
 	}
-
-	if (finish)
-		exit(0);
+	recordlen = size % sizeof(struct mce) ? size : sizeof(struct mce);
+	copy = recordlen < sizeof(struct mce) ? recordlen : sizeof(struct mce);
+
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		err("mmap");
+	madvise(map, size, MADV_SEQUENTIAL);
+	if (parallel_decode)
+		parallel_start(decode_binary_item, sizeof(struct decode_item));
+
+	startbatch();
+	for (off = 0, i = 0; off + recordlen <= size && !finish; off += recordlen, i++) {
+		memset(&m, 0, sizeof(struct mce));
+		memcpy(&m, map + off, copy);
+		finish = process_mce(&m, i, recordlen);
+		if (off + recordlen - done >= BINARY_CHUNK) {
+			size_t end = (off + recordlen) & ~(BINARY_CHUNK - 1);
+
+			flushbatch();
+			record_flush();
+			madvise(map + done, end - done, MADV_DONTNEED);
+			done = end;
+			startbatch();
+		}
+	}
+	if (parallel_decode)
+		parallel_finish();
+	flushbatch();
+	record_flush();
+	munmap(map, size);
+	process_finish(finish, recordlen);
 }
 
 static void noargs(int ac, char **av)
@@ -1267,21 +1836,23 @@ static void parse_config(char **av)
 
 static void ascii_command(int ac, char **av)
 {
-	FILE *f = stdin;
+	int fd = 0;
 
 	argsleft(ac, av);
 	if (inputfile) { 
-		f = fopen(inputfile, "r");
-		if (!f) {		
+		fd = open(inputfile, O_RDONLY);
+		if (fd < 0) {		
 			fprintf(stderr, "Cannot open input file `%s': %s\n",
 				inputfile, strerror(errno));
 			exit(1);
 		}
-		/* f closed by exit */
+		/* fd closed by exit */
 	}
 	no_syslog();
 	checkdmi();
-	decodefatal(f); 
+	record_setup();
+	parallel_setup();
+	decodefatal(fd); 
 }
 
 static void client_command(int ac, char **av)
@@ -1289,6 +1860,10 @@ static void client_command(int ac, char **av)
 	argsleft(ac, av);
 	no_syslog();
 	// XXX modifiers
+	if (binary_file) {
+		ask_server_binary("dump all bios\npages\n");
+		return;
+	}
 	ask_server("dump all bios\n");
 	ask_server("pages\n");
 }
@@ -1360,20 +1935,14 @@ int main(int ac, char **av)
 		exit(0);
 
 	/* If the user didn't tell us not to use iMC logging, check if CPU supports it */
-	if (imc_log == -1) {
-		switch (cputype) {
-		case CPU_SANDY_BRIDGE_EP:
-		case CPU_IVY_BRIDGE_EPEX:
-		case CPU_HASWELL_EPEX:
-			imc_log = 1;
-			break;
-		default:
-			imc_log = 0;
-			break;
-		}
-	}
+	if (imc_log == -1)
+		imc_log = !!(cpu_ops[cputype].flags & OPS_IMCLOG);
 
 	modifier_finish();
+	if (daemon_mode && record_format != RECORD_OFF && !record_file) {
+		Eprintf("--record in daemon mode needs --record-file");
+		exit(1);
+	}
 	if (av[optind])
 		logfn = av[optind++];
 	if (av[optind]) {
@@ -1382,6 +1951,7 @@ int main(int ac, char **av)
 	}
 	checkdmi();
 	general_setup();
+	record_setup();
 		
 	fd = open(logfn, O_RDONLY); 
 	if (fd < 0) {
@@ -1392,34 +1962,39 @@ int main(int ac, char **av)
 		exit(1);
 	}
 	
-	if (binary_file) {
-		d.recordlen = d.loglen = lseek(fd, 0, SEEK_END);
-		lseek(fd, 0, SEEK_SET);
-	} else {
+	if (!binary_file) {
 		if (ioctl(fd, MCE_GET_RECORD_LEN, &d.recordlen) < 0)
 			err("MCE_GET_RECORD_LEN");
 		if (ioctl(fd, MCE_GET_LOG_LEN, &d.loglen) < 0)
 			err("MCE_GET_LOG_LEN");
+		d.buf = xalloc(d.recordlen * d.loglen); 
 	}
 
-	d.buf = xalloc(d.recordlen * d.loglen); 
 	if (daemon_mode) {
 		prefill_memdb(do_dmi);
 		if (!do_dmi)
 			closedmi();
 		server_setup();
 		page_setup();
+		diskdb_setup();
+		wheel_setup();
+		statsfile_setup();
 		if (imc_log)
 			set_imc_log(cputype);
 		drop_cred();
-		register_pollcb(fd, POLLIN, process_mcefd, &d);
+		if (binary_file)
+			process_binary(fd);
+		else
+			register_pollcb(fd, POLLIN, process_mcefd, &d);
 		if (!foreground && daemon(0, need_stdout()) < 0)
 			err("daemon");
 		if (pidfile)
 			write_pidfile();
-		signal(SIGUSR1, handle_sigusr1);
-		event_signal(SIGUSR1);
+		register_signalcb(SIGUSR1, handle_sigusr1);
 		eventloop();
+	} else if (binary_file) {
+		parallel_setup();
+		process_binary(fd);
 	} else {
 		process(fd, d.recordlen, d.loglen, d.buf);
 	}
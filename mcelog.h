@@ -118,6 +118,7 @@ extern int open_logfile(char *fn);
 enum option_ranges {
 	O_COMMON = 500,
 	O_DISKDB = 1000,
+	O_STATS = 1100,
 };
 
 enum syslog_opt { 
@@ -135,7 +136,7 @@ extern char *processor_flags;
 extern int force_tsc;
 extern enum syslog_opt syslog_opt;
 extern int syslog_level;
-extern enum cputype cputype;
+extern __thread enum cputype cputype;
 extern int filter_memory_errors;
 extern int imc_log;
 extern int max_corr_err_counters;
@@ -21,7 +21,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <assert.h>
 #include "mcelog.h"
 #include "memutil.h"
 #include "config.h"
@@ -31,9 +30,11 @@
 #include "trigger.h"
 #include "intel.h"
 #include "page.h"
+#include "diskdb.h"
+#include "statsfile.h"
+#include "server.h"
 
 struct memdimm {
-	struct memdimm *next;
 	int channel;			/* -1: unknown */
 	int dimm;			/* -1: unknown */
 	int socketid;
@@ -42,6 +43,10 @@ struct memdimm {
 	char *name;
 	char *location;
 	struct dmi_memdev *memdev;
+	char *env;			/* trigger environment of the DIMM */
+	size_t envlen;
+	unsigned long long gen;		/* of the last change, 0: none */
+	int newer, older;		/* change list, -1 terminated */
 };
 
 struct err_triggers {
@@ -50,10 +55,19 @@ struct err_triggers {
 	char *type;
 };
 
-#define SHASH 17
+/*
+ * The DIMMs are stored contiguously in md_dimms and found through an
+ * open addressing hash index of md_dimms slots (+1, 0 is empty). Both
+ * grow on demand, so pointers to a memdimm are only valid until the
+ * next insertion.
+ */
+#define MIN_INDEX 32
 
 static int md_numdimms;
-static struct memdimm *md_dimms[SHASH];
+static int md_maxdimms;
+static struct memdimm *md_dimms;
+static unsigned md_indexsize;	/* power of two */
+static unsigned *md_index;
 
 static struct err_triggers dimms = { .type = "DIMM" };
 static struct err_triggers sockets = { .type = "Socket" };
@@ -61,6 +75,12 @@ static struct err_triggers sockets = { .type = "Socket" };
 static int memdb_enabled;
 static int sockdb_enabled;
 
+/* Incremented for every change of a DIMM or page counter */
+unsigned long long error_gen;
+
+/* Most recently changed DIMM, the list links are md_dimms indexes */
+static int md_newest = -1;
+
 #define FNV32_OFFSET 2166136261U
 #define FNV32_PRIME 0x01000193
 #define O(x) ((x) & 0xff)
@@ -73,28 +93,75 @@ static unsigned dimmhash(unsigned socket, int dimm, unsigned ch)
 	hash = (hash ^ O(socket >> 8)) * FNV32_PRIME;
 	hash = (hash ^ O(dimm)) * FNV32_PRIME;
 	hash = (hash ^ O(ch)) * FNV32_PRIME;
-        return hash % SHASH;
+        return hash;
 }
 
-/* Search DIMM in hash table */
-struct memdimm *get_memdimm(int socketid, int channel, int dimm, int insert)
+/* Find the index slot of a DIMM, or the empty slot where it belongs */
+static unsigned *index_slot(int socketid, int channel, int dimm)
 {
+	unsigned mask = md_indexsize - 1;
+	unsigned h = dimmhash(socketid, dimm, channel) & mask;
+	unsigned *slot;
 	struct memdimm *md;
-	unsigned h;
 
-	h = dimmhash(socketid, dimm, channel);
-	for (md = md_dimms[h]; md; md = md->next) { 
+	for (;;) {
+		slot = &md_index[h];
+		if (*slot == 0)
+			return slot;
+		md = &md_dimms[*slot - 1];
 		if (md->socketid == socketid && 
 			md->channel == channel && 
 			md->dimm == dimm)
-			break;	
+			return slot;
+		h = (h + 1) & mask;
 	}
-	if (md || !insert)
-		return md;
+}
+
+/* Make room for n DIMMs, keeping the index at most 3/4 full */
+static void memdb_reserve(int n)
+{
+	unsigned size = md_indexsize ? md_indexsize : MIN_INDEX;
+	int i;
+
+	if (n > md_maxdimms) {
+		md_maxdimms = md_maxdimms ? md_maxdimms : MIN_INDEX / 2;
+		while (md_maxdimms < n)
+			md_maxdimms *= 2;
+		md_dimms = xrealloc(md_dimms, md_maxdimms * sizeof(struct memdimm));
+	}
+	while (size / 4 * 3 < (unsigned)n)
+		size *= 2;
+	if (size == md_indexsize)
+		return;
+
+	free(md_index);
+	md_index = xalloc(size * sizeof(unsigned));
+	md_indexsize = size;
+	for (i = 0; i < md_numdimms; i++) {
+		struct memdimm *md = &md_dimms[i];
+		*index_slot(md->socketid, md->channel, md->dimm) = i + 1;
+	}
+}
+
+/* Search DIMM in hash table */
+struct memdimm *get_memdimm(int socketid, int channel, int dimm, int insert)
+{
+	struct memdimm *md;
+	unsigned *slot;
 
-	md = xalloc(sizeof(struct memdimm));
-	md->next = md_dimms[h];
-	md_dimms[h] = md;
+	if (md_indexsize) {
+		slot = index_slot(socketid, channel, dimm);
+		if (*slot)
+			return &md_dimms[*slot - 1];
+	}
+	if (!insert)
+		return NULL;
+
+	memdb_reserve(md_numdimms + 1);
+	slot = index_slot(socketid, channel, dimm);
+	*slot = md_numdimms + 1;
+	md = &md_dimms[md_numdimms];
+	memset(md, 0, sizeof(struct memdimm));
 	md->socketid = socketid;
 	md->channel = channel;
 	md->dimm = dimm;
@@ -106,7 +173,6 @@ struct memdimm *get_memdimm(int socketid, int channel, int dimm, int insert)
 
 enum {
 	NUMLEN  = 30,
-	MAX_ENV = 20,
 };
 
 static char *number(char *buf, long num)
@@ -115,78 +181,127 @@ static char *number(char *buf, long num)
 	return buf;
 }
 
-static char *format_location(struct memdimm *md)
+#define LOCATION_VAR "LOCATION="
+
+/*
+ * The trigger environment that stays the same for a DIMM, formatted
+ * at the DMI prefill or when the first threshold is crossed. It starts
+ * with LOCATION.
+ */
+static void memdimm_env(struct memdimm *md)
 {
 	char numbuf[NUMLEN], numbuf2[NUMLEN];
-	char *location;
 
-	xasprintf(&location, "SOCKET:%d CHANNEL:%s DIMM:%s [%s%s%s]",
+	trigger_env_start();
+	trigger_env_add(LOCATION_VAR "SOCKET:%d CHANNEL:%s DIMM:%s [%s%s%s]",
 		md->socketid, 
 		md->channel == -1 ? "?" : number(numbuf, md->channel),
 		md->dimm == -1 ? "?" : number(numbuf2, md->dimm),
 		md->location ? md->location : "",
 		md->location && md->name ? " " : "",
 		md->name ? md->name : ""); 
-	return location;
+	trigger_env_add("PATH=%s", getenv("PATH") ?: "/sbin:/usr/sbin:/bin:/usr/bin");
+	if (md->location)
+		trigger_env_add("DMI_LOCATION=%s", md->location);
+	if (md->name)
+		trigger_env_add("DMI_NAME=%s", md->name);
+	if (md->dimm != -1)
+		trigger_env_add("DIMM=%d", md->dimm);
+	if (md->channel != -1)
+		trigger_env_add("CHANNEL=%d", md->channel);
+	trigger_env_add("SOCKETID=%d", md->socketid);
+	free(md->env);
+	md->env = trigger_env_save(&md->envlen);
 }
 
 /* Run a user defined trigger when a error threshold is crossed. */
 void memdb_trigger(char *msg, struct memdimm *md,  time_t t,
-		struct err_type *et, struct bucket_conf *bc, char *args[], bool sync,
-		const char* reporter)
+		struct leaky_bucket *bucket, unsigned count, struct bucket_conf *bc,
+		char *args[], bool sync, const char* reporter)
 {
-	struct leaky_bucket *bucket = &et->bucket;
-	char *env[MAX_ENV]; 
-	int ei = 0;
-	int i;
-	char *location = format_location(md);
 	char *thresh = bucket_output(bc, bucket);
 	char *out;
 
+	if (!md->env)
+		memdimm_env(md);
 	xasprintf(&out, "%s: %s", msg, thresh);
+	server_publish_threshold(out);
 	if (bc->log) { 
 		Gprintf("%s\n", out); 
-		Gprintf("Location %s\n", location);
+		Gprintf("Location %s\n", md->env + strlen(LOCATION_VAR));
 	}
 	if (bc->trigger == NULL)
 		goto out;
-	xasprintf(&env[ei++], "PATH=%s", getenv("PATH") ?: "/sbin:/usr/sbin:/bin:/usr/bin");
-	xasprintf(&env[ei++], "THRESHOLD=%s", thresh);
-	xasprintf(&env[ei++], "TOTALCOUNT=%lu", et->count);
-	xasprintf(&env[ei++], "LOCATION=%s", location);
-	if (md->location)
-		xasprintf(&env[ei++], "DMI_LOCATION=%s", md->location);
-	if (md->name)
-		xasprintf(&env[ei++], "DMI_NAME=%s", md->name);
-	if (md->dimm != -1)
-		xasprintf(&env[ei++], "DIMM=%d", md->dimm);
-	if (md->channel != -1)
-		xasprintf(&env[ei++], "CHANNEL=%d", md->channel);
-	xasprintf(&env[ei++], "SOCKETID=%d", md->socketid);
-	xasprintf(&env[ei++], "CECOUNT=%lu", md->ce.count);
-	xasprintf(&env[ei++], "UCCOUNT=%lu", md->uc.count);
+	trigger_env_start();
+	trigger_env_add_saved(md->env, md->envlen);
+	trigger_env_add("THRESHOLD=%s", thresh);
+	trigger_env_add("TOTALCOUNT=%u", count);
+	trigger_env_add("CECOUNT=%u", md->ce.count);
+	trigger_env_add("UCCOUNT=%u", md->uc.count);
 	if (t)
-		xasprintf(&env[ei++], "LASTEVENT=%lu", t);
-	xasprintf(&env[ei++], "AGETIME=%u", bc->agetime);
+		trigger_env_add("LASTEVENT=%lu", t);
+	trigger_env_add("AGETIME=%u", bc->agetime);
 	// XXX human readable version of agetime
-	xasprintf(&env[ei++], "MESSAGE=%s", out);
-	xasprintf(&env[ei++], "THRESHOLD_COUNT=%d", bucket->count);
-	env[ei] = NULL;	
-	assert(ei < MAX_ENV);
-	run_trigger(bc->trigger, args, env, sync, reporter);
-	for (i = 0; i < ei; i++) {
-		free(env[i]);
-		env[i] = NULL;
-	}
+	trigger_env_add("MESSAGE=%s", out);
+	trigger_env_add("THRESHOLD_COUNT=%d", bucket->count);
+	run_trigger(bc->trigger, args, trigger_env_finish(), sync, reporter);
 out:
-	free(location);
-	location = NULL;
 	free(out);
 	out = NULL;
 	free(thresh);
 	thresh = NULL;
 }
 
+/* Move a changed DIMM to the front of the change list */
+static void memdimm_changed(struct memdimm *md)
+{
+	int i = md - md_dimms;
+
+	if (md->gen) {
+		if (md->newer >= 0)
+			md_dimms[md->newer].older = md->older;
+		else
+			md_newest = md->older;
+		if (md->older >= 0)
+			md_dimms[md->older].newer = md->newer;
+	}
+	md->newer = -1;
+	md->older = md_newest;
+	if (md_newest >= 0)
+		md_dimms[md_newest].newer = i;
+	md_newest = i;
+	md->gen = ++error_gen;
+}
+
+static void memdb_save(struct memdimm *md, time_t t)
+{
+	uint64_t key2 = DB_DIMM_KEY(md->channel, md->dimm);
+	struct db_dimm d = {
+		.ce_count = md->ce.count,
+		.uc_count = md->uc.count,
+		.last = t ? t : bucket_time(),
+	};
+
+	memdimm_changed(md);
+	d.first = diskdb_first(DB_DIMM, md->socketid, key2, sizeof(d), d.last);
+	diskdb_bucket(&d.ce, &md->ce.bucket);
+	diskdb_bucket(&d.uc, &md->uc.bucket);
+	diskdb_put(DB_DIMM, md->socketid, key2, &d, sizeof(d));
+	stats_changed();
+}
+
+/* Restore the counters of a DIMM from the database */
+void memdb_restore(uint64_t socket, uint64_t chdimm, const struct db_dimm *d)
+{
+	struct memdimm *md = get_memdimm(socket, DB_KEY_CHANNEL(chdimm),
+					 DB_KEY_DIMM(chdimm), 1);
+
+	md->ce.count = d->ce_count;
+	md->uc.count = d->uc_count;
+	diskdb_restore_bucket(&md->ce.bucket, &d->ce);
+	diskdb_restore_bucket(&md->uc.bucket, &d->uc);
+}
+
 /* 
  * Lost some errors. Assume they were CE. Only works for the sockets because
  * we have no clues where they are.
@@ -200,10 +315,12 @@ account_over(struct err_triggers *t, struct memdimm *md, struct mce *m, unsigned
 			char *msg;
 			xasprintf(&msg, "Fallback %s memory error count %d exceeded threshold",
 				 t->type, corr_err_cnt);
-			memdb_trigger(msg, md, 0, &md->ce, &t->ce_bucket_conf, NULL, false, reporter);
+			memdb_trigger(msg, md, 0, &md->ce.bucket, md->ce.count,
+				      &t->ce_bucket_conf, NULL, false, reporter);
 			free(msg);
 			msg = NULL;
 		}
+		memdb_save(md, m->time);
 	}
 }
 
@@ -218,12 +335,15 @@ account_memdb(struct err_triggers *t, struct memdimm *md, struct mce *m, const c
 	if (m->status & MCI_STATUS_UC) { 
 		md->uc.count++;
 		if (__bucket_account(&t->uc_bucket_conf, &md->uc.bucket, 1, m->time, 1))
-			memdb_trigger(msg, md, m->time, &md->uc, &t->uc_bucket_conf, NULL, false, reporter);
+			memdb_trigger(msg, md, m->time, &md->uc.bucket, md->uc.count,
+				      &t->uc_bucket_conf, NULL, false, reporter);
 	} else {
 		md->ce.count++;
 		if (__bucket_account(&t->ce_bucket_conf, &md->ce.bucket, 1, m->time, 1))
-			memdb_trigger(msg, md, m->time, &md->ce, &t->ce_bucket_conf, NULL, false, reporter);
+			memdb_trigger(msg, md, m->time, &md->ce.bucket, md->ce.count,
+				      &t->ce_bucket_conf, NULL, false, reporter);
 	}
+	memdb_save(md, m->time);
 	free(msg);
 	msg = NULL;
 }
@@ -276,16 +396,18 @@ static void dump_errtype(char *name, struct err_type *e, FILE *f, enum printflag
 			 struct bucket_conf *bc)
 {
 	int all = (flags & DUMP_ALL);
+	struct leaky_bucket bucket = e->bucket;
 	char *s;
 
-	bucket_age(bc, &e->bucket, bucket_time(), 1);
-	if (e->count || e->bucket.count || all)
+	/* Show the aged state, but leave the bucket alone */
+	bucket_age(bc, &bucket, bucket_time(), 1);
+	if (e->count || bucket.count || all)
 		fprintf(f, "%s:\n", name);
 	if (e->count || all) {
 		fprintf(f, "\t%u total\n", e->count);
 	}
-	if (bc->capacity && (e->bucket.count || all)) {
-		s = bucket_output(bc, &e->bucket);
+	if (bc->capacity && (bucket.count || all)) {
+		s = bucket_output(bc, &bucket);
 		fprintf(f, "\t%s\n", s);  
 		free(s);
 		s = NULL;
@@ -307,8 +429,33 @@ static void dump_bios(struct memdimm *md, FILE *f)
 		fputc('\n', f);
 }
 
+static void dump_dimm_frame(struct memdimm *md, FILE *f)
+{
+	struct mce_frame_dimm d = {
+		.socketid = md->socketid,
+		.channel = md->channel,
+		.dimm = md->dimm,
+		.ce_count = md->ce.count,
+		.uc_count = md->uc.count,
+	};
+	struct leaky_bucket ce = md->ce.bucket, uc = md->uc.bucket;
+
+	/* Aged like the text dump */
+	bucket_age(&dimms.ce_bucket_conf, &ce, bucket_time(), 1);
+	bucket_age(&dimms.uc_bucket_conf, &uc, bucket_time(), 1);
+	frame_bucket(&d.ce, &ce);
+	frame_bucket(&d.uc, &uc);
+	put_frame(f, md->channel == -1 && md->dimm == -1 ?
+		  MCE_FRAME_SOCKET : MCE_FRAME_DIMM, &d, sizeof(d));
+}
+
 static void dump_dimm(struct memdimm *md, FILE *f, enum printflags flags)
 {
+	if (flags & DUMP_BINARY) {
+		if (md->ce.count + md->uc.count > 0 || (flags & DUMP_ALL))
+			dump_dimm_frame(md, f);
+		return;
+	}
 	if (md->ce.count + md->uc.count > 0 || (flags & DUMP_ALL)) {
 		fprintf(f, "SOCKET %u", md->socketid);
 		if (md->channel == -1)
@@ -330,30 +477,66 @@ static void dump_dimm(struct memdimm *md, FILE *f, enum printflags flags)
 	}
 }
 
-/* Sort and dump DIMMs */
-void dump_memory_errors(FILE *f, enum printflags flags)
+/* 
+ * Sort and dump DIMMs, with since only the ones that changed after that
+ * generation. These are found on the change list, so polling costs
+ * depend on the number of changes, not the number of DIMMs.
+ */
+void dump_memory_errors(FILE *f, enum printflags flags, unsigned long long since)
 {
-	int i, k;
-	struct memdimm *md, **da;
+	int i, n = 0;
+	struct memdimm **da;
 
 	da = xalloc(sizeof(void *) * md_numdimms);
-	k = 0;
-	for (i = 0; i < SHASH; i++) {
-		for (md = md_dimms[i]; md; md = md->next)
-			da[k++] = md;
+	if (since) {
+		for (i = md_newest; i >= 0 && md_dimms[i].gen > since; i = md_dimms[i].older)
+			da[n++] = &md_dimms[i];
+	} else {
+		for (i = 0; i < md_numdimms; i++)
+			da[n++] = &md_dimms[i];
 	}
-	qsort(da, md_numdimms, sizeof(void *), cmp_dimm);
-	for (i = 0; i < md_numdimms; i++)  {
-		if (i > 0)  
-			fputc('\n', f);
-		else
-			fprintf(f, "Memory errors\n");
+	qsort(da, n, sizeof(void *), cmp_dimm);
+	for (i = 0; i < n; i++)  {
+		if (!(flags & DUMP_BINARY)) {
+			if (i > 0)  
+				fputc('\n', f);
+			else
+				fprintf(f, "Memory errors\n");
+		}
 		dump_dimm(da[i], f, flags);
 	}
 	free(da);
 	da = NULL;
 }
 
+static void copy_dmi_string(char *dst, size_t len, const char *s)
+{
+	snprintf(dst, len, "%s", s ? s : "");
+}
+
+/* Publish the counters of all DIMMs and sockets */
+void memdb_stats(void)
+{
+	int i;
+
+	for (i = 0; i < md_numdimms; i++) {
+		struct memdimm *md = &md_dimms[i];
+		struct stats_dimm *d = stats_add_dimm();
+
+		if (!d)
+			return;
+		d->socketid = md->socketid;
+		d->channel = md->channel;
+		d->dimm = md->dimm;
+		d->ce_count = md->ce.count;
+		d->uc_count = md->uc.count;
+		stats_bucket(&d->ce, &md->ce.bucket);
+		stats_bucket(&d->uc, &md->uc.bucket);
+		copy_dmi_string(d->location, sizeof(d->location), md->location);
+		copy_dmi_string(d->name, sizeof(d->name), md->name);
+	}
+}
+
 void memdb_config(void)
 {
 	int n;
@@ -419,6 +602,11 @@ void prefill_memdb(int do_dmi)
 	if (opendmi() < 0)
 		return;
 
+	/* Size the database for all DIMMs the BIOS knows about */
+	for (i = 0; dmi_dimms[i]; i++)
+		;
+	memdb_reserve(md_numdimms + i);
+
 	for (i = 0; dmi_dimms[i]; i++) {
 		struct memdimm *md;
 		struct dmi_memdev *d = dmi_dimms[i];
@@ -439,6 +627,7 @@ void prefill_memdb(int do_dmi)
 		md->memdev = d;
 		md->location = xstrdup(bl);
 		md->name = xstrdup(dmi_getstring(&d->header, d->device_locator));
+		memdimm_env(md);
 	}
 	if (missed) { 
 		static int warned;
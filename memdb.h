@@ -9,17 +9,20 @@ struct err_type {
 enum printflags {
 	DUMP_ALL  = (1 << 0),
 	DUMP_BIOS = (1 << 1),
+	DUMP_BINARY = (1 << 2),		/* frames of server.h */
 };	
 
 void prefill_memdb(int do_dmi);
 void memdb_config(void);
-void dump_memory_errors(FILE *f, enum printflags flags);
+void dump_memory_errors(FILE *f, enum printflags flags, unsigned long long since);
+
+extern unsigned long long error_gen;
 
 void memory_error(struct mce *m, int channel, int dimm, unsigned corr_err_cnt,
 			unsigned recordlen);
 
 struct memdimm;
 void memdb_trigger(char *msg, struct memdimm *md,  time_t t,
-		   struct err_type *et, struct bucket_conf *bc, char *argv[], bool sync,
-           const char* reporter);
+		   struct leaky_bucket *bucket, unsigned count, struct bucket_conf *bc,
+		   char *argv[], bool sync, const char* reporter);
 struct memdimm *get_memdimm(int socketid, int channel, int dimm, int insert);
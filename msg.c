@@ -5,15 +5,30 @@
 #include <errno.h>
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "mcelog.h"
 #include "msg.h"
 #include "memutil.h"
 
 enum syslog_opt syslog_opt = SYSLOG_REMARK;
 int syslog_level = LOG_WARNING;
+int wprintf_quiet;
 static FILE *output_fh;
 static char *output_fn;
 
+/* Arena collecting the decoded output of a batch of records, per decoding thread */
+static __thread char *batch_buf;
+static __thread size_t batch_len;
+static __thread size_t batch_size;
+static __thread int batching;
+
+/* Copy of the decoded output, for structured records */
+static __thread char *capture_buf;
+static __thread size_t capture_len;
+static __thread size_t capture_size;
+static __thread int capturing;
+
 int need_stdout(void)
 {
 	return !output_fh && (syslog_opt == 0);
@@ -32,15 +47,61 @@ int open_logfile(char *fn)
 	return -1;
 }
 
-static void opensyslog(void)
+static FILE *logfh(void)
+{
+	return output_fh ? output_fh : stdout;
+}
+
+static int batch_vprintf(const char *fmt, va_list ap)
+{
+	va_list aq;
+	int n;
+
+	va_copy(aq, ap);
+	n = vsnprintf(batch_buf + batch_len, batch_size - batch_len, fmt, aq);
+	va_end(aq);
+	if (n < 0)
+		return n;
+	if (batch_len + n >= batch_size) {
+		batch_size = batch_size * 2 > batch_len + n + 1 ?
+			batch_size * 2 : batch_len + n + 1;
+		batch_buf = xrealloc(batch_buf, batch_size);
+		n = vsnprintf(batch_buf + batch_len, batch_size - batch_len, fmt, ap);
+	}
+	batch_len += n;
+	return n;
+}
+
+/* Output to the log stream goes into the batch arena while batching */
+static int log_vprintf(FILE *f, const char *fmt, va_list ap)
+{
+	if (batching && f == logfh())
+		return batch_vprintf(fmt, ap);
+	return vfprintf(f, fmt, ap);
+}
+
+static int log_printf(FILE *f, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = log_vprintf(f, fmt, ap);
+	va_end(ap);
+	return n;
+}
+
+static void do_opensyslog(void)
 {
-	static int syslog_opened;
-	if (syslog_opened)
-		return;
-	syslog_opened = 1;
 	openlog("mcelog", 0, 0);
 }
 
+static void opensyslog(void)
+{
+	static pthread_once_t syslog_opened = PTHREAD_ONCE_INIT;
+	pthread_once(&syslog_opened, do_opensyslog);
+}
+
 /* For warning messages that should reach syslog */
 void Lprintf(char *fmt, ...)
 {
@@ -54,7 +115,7 @@ void Lprintf(char *fmt, ...)
 	if (output_fh || !(syslog_opt & SYSLOG_REMARK)) {
 		va_start(ap, fmt);
 		opensyslog();
-		vfprintf(output_fh ? output_fh : stdout, fmt, ap);
+		log_vprintf(logfh(), fmt, ap);
 		va_end(ap);
 	}
 }
@@ -67,10 +128,10 @@ void Eprintf(char *fmt, ...)
 
 	if (!(syslog_opt & SYSLOG_ERROR) || output_fh) {
 		va_start(ap, fmt);
-		fputs("mcelog: ", f);
-		vfprintf(f, fmt, ap);
+		log_printf(f, "mcelog: ");
+		log_vprintf(f, fmt, ap);
 		if (*fmt && fmt[strlen(fmt)-1] != '\n')
-			fputc('\n', f);
+			log_printf(f, "\n");
 		va_end(ap);
 	}
 	if (syslog_opt & SYSLOG_ERROR) { 
@@ -89,9 +150,9 @@ void SYSERRprintf(char *fmt, ...)
 
 	if (!(syslog_opt & SYSLOG_ERROR) || output_fh) {
 		va_start(ap, fmt);
-		fputs("mcelog: ", f);
-		vfprintf(f, fmt, ap);
-		fprintf(f, ": %s\n", err);
+		log_printf(f, "mcelog: ");
+		log_vprintf(f, fmt, ap);
+		log_printf(f, ": %s\n", err);
 		va_end(ap);
 	}
 	if (syslog_opt & SYSLOG_ERROR) { 
@@ -109,7 +170,7 @@ void SYSERRprintf(char *fmt, ...)
 /* Write to syslog with line buffering */
 static int vlinesyslog(char *fmt, va_list ap)
 {
-	static char line[200];
+	static __thread char line[200];
 	int n;
 	int lend = strlen(line); 
 	int w = vsnprintf(line + lend, sizeof(line)-lend, fmt, ap);
@@ -121,11 +182,53 @@ static int vlinesyslog(char *fmt, va_list ap)
 	return w;
 }
 
+static void capture_vprintf(const char *fmt, va_list ap)
+{
+	va_list aq;
+	int n;
+
+	va_copy(aq, ap);
+	n = vsnprintf(capture_buf + capture_len, capture_size - capture_len, fmt, aq);
+	va_end(aq);
+	if (n < 0)
+		return;
+	if (capture_len + n >= capture_size) {
+		capture_size = capture_size * 2 > capture_len + n + 1 ?
+			capture_size * 2 : capture_len + n + 1;
+		capture_buf = xrealloc(capture_buf, capture_size);
+		vsnprintf(capture_buf + capture_len, capture_size - capture_len, fmt, ap);
+	}
+	capture_len += n;
+}
+
+/* Also collect the decoded output until capture_end() */
+void capture_start(void)
+{
+	capturing = 1;
+	capture_len = 0;
+	if (capture_buf)
+		capture_buf[0] = 0;
+}
+
+/* Return the output since capture_start(), valid until the next capture */
+char *capture_end(void)
+{
+	capturing = 0;
+	return capture_buf && capture_len ? capture_buf : "";
+}
+
 /* For decoded machine check output */
 int Wprintf(char *fmt, ...)
 {
 	int n = 0;
 	va_list ap;
+	if (capturing) {
+		va_start(ap, fmt);
+		capture_vprintf(fmt, ap);
+		va_end(ap);
+	}
+	if (wprintf_quiet)
+		return 0;
 	if (syslog_opt & SYSLOG_LOG) {
 		va_start(ap,fmt);
 		opensyslog();
@@ -134,7 +237,7 @@ int Wprintf(char *fmt, ...)
 	}
 	if (!(syslog_opt & SYSLOG_LOG) || output_fh) {
 		va_start(ap,fmt);
-		n = vfprintf(output_fh ? output_fh : stdout, fmt, ap);
+		n = log_vprintf(logfh(), fmt, ap);
 		va_end(ap);
 	}
 	return n;
@@ -151,15 +254,59 @@ void Gprintf(char *fmt, ...)
 	}
 	if (!(syslog_opt & SYSLOG_LOG) || output_fh) { 
 		va_start(ap,fmt);
-		vfprintf(output_fh ? output_fh : stdout, fmt, ap);
+		log_vprintf(logfh(), fmt, ap);
 		va_end(ap);
 	}
 }
 
 void flushlog(void)
 {
-	FILE *f = output_fh ? output_fh : stdout;
+	if (!batching)
+		fflush(logfh());
+}
+
+/* Collect all log output until flushbatch() */
+void startbatch(void)
+{
+	batching = 1;
+	batch_len = 0;
+}
+
+/* Stop batching and return the collected output, which the caller frees */
+char *takebatch(size_t *len)
+{
+	char *buf = batch_buf;
+
+	*len = batch_len;
+	batching = 0;
+	batch_buf = NULL;
+	batch_len = batch_size = 0;
+	return buf;
+}
+
+/* Write out a batch with a single write and flush the log */
+void flushbatch(void)
+{
+	batching = 0;
+	writebatch(batch_buf, batch_len);
+	batch_len = 0;
+}
+
+void writebatch(char *p, size_t left)
+{
+	FILE *f = logfh();
+
 	fflush(f);
+	while (left > 0) {
+		ssize_t n = write(fileno(f), p, left);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		p += n;
+		left -= n;
+	}
 }
 
 void reopenlog(void)
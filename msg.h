@@ -1,4 +1,14 @@
+#include <stddef.h>
+
 int need_stdout(void);
 void flushlog(void);
 void reopenlog(void);
+void startbatch(void);
+void flushbatch(void);
+char *takebatch(size_t *len);
+void writebatch(char *buf, size_t len);
+void capture_start(void);
+char *capture_end(void);
+
+extern int wprintf_quiet;
 /* others are in mcelog.h */
@@ -141,8 +141,9 @@ void decode_memory_controller(u32 status, u8 bank)
 	Wprintf("Transaction: %s\n", mmm_desc[(status >> 4) & 7]);
 }
 
-void nehalem_decode_model(u64 status, u64 misc)
+void nehalem_decode_model(int cputype, struct mce *m)
 {
+	u64 status = m->status, misc = m->misc;
 	u32 mca = status & 0xffff;
 	if ((mca >> 11) == 1) { 	/* bus and interconnect QPI */
 		decode_bitfield(status, qpi_status);
@@ -162,7 +163,7 @@ void nehalem_decode_model(u64 status, u64 misc)
 }
 
 /* Only core errors supported. Same as Nehalem */
-void xeon75xx_decode_model(struct mce *m, unsigned msize)
+void xeon75xx_decode_model(int cputype, struct mce *m)
 {
 	u64 status = m->status;
 	u32 mca = status & 0xffff;
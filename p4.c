@@ -24,26 +24,13 @@
 #include <stddef.h>
 #include "mcelog.h"
 #include "p4.h"
-#include "core2.h"
 #include "nehalem.h"
-#include "dunnington.h"
-#include "tulsa.h"
 #include "intel.h"
 #include "yellow.h"
 #include "bus.h"
 #include "unknown.h"
 #include "bitfield.h"
-#include "sandy-bridge.h"
-#include "ivy-bridge.h"
-#include "haswell.h"
-#include "broadwell_de.h"
-#include "broadwell_epex.h"
-#include "skylake_xeon.h"
-#include "denverton.h"
-#include "i10nm.h"
-#include "sapphire.h"
-#include "granite.h"
-#include "diamond.h"
+#include "record.h"
 
 /* decode mce for P4/Xeon and Core2 family */
 
@@ -252,8 +239,9 @@ static int decode_mca(u64 status, u64 misc, u64 track, int cpu, int *ismemerr, i
 	return ret;
 }
 
-static void p4_decode_model(__u32 model)
+void p4_decode_model(u64 status)
 {
+	__u32 model = status & 0xffff0000L;
 	static struct {
 		int value;
 		char *str;
@@ -305,18 +293,9 @@ static const char *ce_types[] = {
 
 static int check_for_mirror(__u8 bank, __u64  status, __u64 misc)
 {
-	switch (cputype) {
-	case CPU_BROADWELL_EPEX:
-		return bdw_epex_ce_type(bank, status, misc);
-	case CPU_SKYLAKE_XEON:
-		return skylake_s_ce_type(bank, status, misc);
-	case CPU_ICELAKE_XEON:
-		return i10nm_ce_type(bank, status, misc);
-	case CPU_SAPPHIRERAPIDS:
-	case CPU_EMERALDRAPIDS:
-	default:
-		return 0;
-	}
+	if (cpu_ops[cputype].ce_type)
+		return cpu_ops[cputype].ce_type(bank, status, misc);
+	return 0;
 }
 
 static int decode_mci(__u64 status, __u64 misc, int cpu, unsigned mcgcap, int *ismemerr,
@@ -362,7 +341,10 @@ static int decode_mci(__u64 status, __u64 misc, int cpu, unsigned mcgcap, int *i
 		decode_tracking(track);
 	}
 	Wprintf("MCA: ");
-	return decode_mca(status, misc, track, cpu, ismemerr, socket, bank);
+	record_text_begin();
+	i = decode_mca(status, misc, track, cpu, ismemerr, socket, bank);
+	record_text_end(REC_MCA_TEXT);
+	return i;
 }
 
 static void decode_mcg(__u64 mcgstatus)
@@ -395,6 +377,7 @@ void decode_intel_mc(struct mce *log, int cputype, int *ismemerr, unsigned size)
 {
 	int socket = size > offsetof(struct mce, socketid) ? (int)log->socketid : -1;
 	int cpu = log->extcpu ? log->extcpu : log->cpu;
+	const struct cpu_ops *ops = &cpu_ops[cputype];
 
 	if (log->bank == MCE_THERMAL_BANK) { 
 		decode_thermal(log, cpu);
@@ -407,85 +390,20 @@ void decode_intel_mc(struct mce *log, int cputype, int *ismemerr, unsigned size)
 		socket, log->bank))
 		run_unknown_trigger(socket, cpu, log);
 
-	if (test_prefix(11, (log->status & 0xffffL))) {
-		switch (cputype) {
-		case CPU_P6OLD:
-			p6old_decode_model(log->status);
-			break;
-		case CPU_DUNNINGTON:
-		case CPU_CORE2:
-			core2_decode_model(log->status);
-			break;
-		case CPU_TULSA:
-		case CPU_P4:
-			p4_decode_model(log->status & 0xffff0000L);
-			break;
-		case CPU_NEHALEM:
-		case CPU_XEON75XX:
-			core2_decode_model(log->status);
-			break;
-		}
-	}
+	if (test_prefix(11, (log->status & 0xffffL)) && ops->decode_bus)
+		ops->decode_bus(log->status);
 
 	/* Model specific addon information */
-	switch (cputype) { 
-	case CPU_NEHALEM:
-		nehalem_decode_model(log->status, log->misc);
-		break;
-	case CPU_DUNNINGTON:
-		dunnington_decode_model(log->status);
-		break;
-	case CPU_TULSA:
-		tulsa_decode_model(log->status, log->misc);
-		break;
-	case CPU_XEON75XX:
-		xeon75xx_decode_model(log, size);
-		break;
-	case CPU_SANDY_BRIDGE:
-	case CPU_SANDY_BRIDGE_EP:
-		snb_decode_model(cputype, log->bank, log->status, log->misc);
-		break;
-	case CPU_IVY_BRIDGE_EPEX:
-		ivb_decode_model(cputype, log->bank, log->status, log->misc);
-		break;
-	case CPU_HASWELL_EPEX:
-		hsw_decode_model(cputype, log->bank, log->status, log->misc);
-		break;
-	case CPU_BROADWELL_DE:
-		bdw_de_decode_model(cputype, log->bank, log->status, log->misc);
-		break;
-	case CPU_BROADWELL_EPEX:
-		bdw_epex_decode_model(cputype, log->bank, log->status, log->misc);
-		break;
-	case CPU_SKYLAKE_XEON:
-		skylake_s_decode_model(cputype, log->bank, log->status, log->misc);
-		break;
-	case CPU_ICELAKE_XEON:
-	case CPU_ICELAKE_DE:
-	case CPU_TREMONT_D:
-		i10nm_decode_model(cputype, log->bank, log->status, log->misc);
-		break;
-	case CPU_SAPPHIRERAPIDS:
-	case CPU_EMERALDRAPIDS:
-		sapphire_decode_model(cputype, log->bank, log->status, log->misc);
-		break;
-	case CPU_GRANITERAPIDS:
-	case CPU_SIERRAFOREST:
-	case CPU_CLEARWATERFOREST:
-		granite_decode_model(cputype, log->bank, log->status, log->misc);
-		break;
-	case CPU_DIAMONDRAPIDS:
-		diamond_decode_model(cputype, log);
-		break;
-	case CPU_DENVERTON:
-		denverton_decode_model(cputype, log->bank, log->status, log->misc);
-		break;
+	if (ops->decode_model) {
+		record_text_begin();
+		ops->decode_model(cputype, log);
+		record_text_end(REC_MODEL_TEXT);
 	}
 }
 
-char *intel_bank_name(int num)
+char *intel_bank_name(unsigned num)
 {
-	static char bname[64];
-	sprintf(bname, "BANK %d", num);
+	static __thread char bname[64];
+	sprintf(bname, "BANK %u", num);
 	return bname;
 }
@@ -1,4 +1,5 @@
-char *intel_bank_name(int num);
+char *intel_bank_name(unsigned num);
 void decode_intel_mc(struct mce *log, int cpu, int *ismemerr, unsigned len);
+void p4_decode_model(u64 status);
 
 
@@ -16,9 +16,15 @@
    on your Linux system; if not, write to the Free Software Foundation, 
    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA */
 
-/* NB 
-   investigate other data structures. Primary consideration would 
-   be space efficiency. rbtree nodes are rather large.  */
+/* The tracked pages are found through sorted 64bit keys, each holding
+   the page frame number and the slot of its counter. The keys are kept
+   in page sized chunks, so adding or removing one moves at most a chunk.
+   The counters themselves live in page sized clusters, and their place
+   in the list of changes in an array beside them. A tracked page costs
+   a 32 byte counter, 16 bytes of change state and 8 to 16 bytes of key,
+   depending on how full the chunks are.
+   When all counters are used the least recently hit page loses its
+   counter, approximated by a CLOCK sweep over the counter slots. */
 #define _GNU_SOURCE 1 
 #include <stdlib.h>
 #include <stdio.h>
@@ -27,17 +33,18 @@
 #include <errno.h>
 #include <string.h>
 #include <sys/mman.h>
-#include <assert.h>
 #include "memutil.h"
 #include "trigger.h"
 #include "mcelog.h"
-#include "rbtree.h"
-#include "list.h"
 #include "leaky-bucket.h"
 #include "page.h"
 #include "config.h"
 #include "memdb.h"
 #include "sysfs.h"
+#include "diskdb.h"
+#include "timewheel.h"
+#include "statsfile.h"
+#include "server.h"
 
 #define PAGE_SHIFT 12
 #define PAGE_SIZE (1UL << PAGE_SHIFT)
@@ -47,22 +54,46 @@
 enum { PAGE_ONLINE = 0, PAGE_OFFLINE = 1, PAGE_OFFLINE_FAILED = 2 };
 
 struct mempage { 
-	struct rb_node nd;
+	struct leaky_bucket bucket;
+	unsigned count;
 	char offlined;
 	char triggered;
 	unsigned char offline_threshold_multiplier;
-	// 1(32bit)-5(64bit) bytes of padding to play with here
+	char referenced;	/* hit since the last CLOCK sweep */
 	u64 addr;
-	struct err_type ce;
 };
 
-#define N ((PAGE_SIZE - sizeof(struct list_head)) / sizeof(struct mempage))
+#define N ((PAGE_SIZE - sizeof(struct wheel_timer) - 2*sizeof(int) - 2) / sizeof(struct mempage))
 #define to_cluster(mp)	(struct mempage_cluster *)((long)(mp) & ~((long)(PAGE_SIZE - 1)))
 
+/*
+ * The counters of a cluster that can expire are queued by the time their
+ * bucket drains, which follows the order they are accounted in. The
+ * cluster timer is armed for the first of them.
+ */
 struct mempage_cluster {
-	struct list_head lru;
 	struct mempage mp[N];
+	struct wheel_timer expire;	/* when the first bucket has drained */
 	int mp_used;
+	int num;
+	unsigned char first, last;	/* expiry queue, NO_SLOT: empty */
+};
+
+#define NO_SLOT 0xff		/* above all counters of a cluster */
+
+/* Index key: page frame number above the counter slot */
+#define SLOT_BITS 24
+#define MAX_SLOTS (1U << SLOT_BITS)
+#define KEY(addr, slot)	(((addr) >> PAGE_SHIFT) << SLOT_BITS | (slot))
+#define KEY_ADDR(k)	(((k) >> SLOT_BITS) << PAGE_SHIFT)
+#define KEY_SLOT(k)	((unsigned)((k) & (MAX_SLOTS - 1)))
+
+/* Sorted keys, all above the keys of the chunks before */
+#define INDEX_CHUNK ((PAGE_SIZE - sizeof(long)) / sizeof(u64))
+
+struct index_chunk {
+	unsigned long len;
+	u64 key[INDEX_CHUNK];
 };
 
 struct mempage_replacement {
@@ -70,19 +101,44 @@ struct mempage_replacement {
 	unsigned count;
 };
 
-enum {
-	MAX_ENV = 20,
-};
-
 static int corr_err_counters;
+static unsigned *free_slots;	/* counters of expired pages */
+static unsigned num_free_slots;
 static struct mempage_cluster *mp_cluster;
+static struct mempage_cluster **mp_clusters;
+static int num_clusters;
 static struct mempage_replacement mp_replacement;
-static struct rb_root mempage_root;
-static LIST_HEAD(mempage_cluster_lru_list);
+static struct index_chunk **index_chunks;
+static unsigned num_chunks, chunks_size;
+static unsigned clock_hand;
 static struct bucket_conf page_trigger_conf;
 static struct bucket_conf mp_replacement_trigger_conf;
 static char *page_error_pre_soft_trigger, *page_error_post_soft_trigger;
 static unsigned offline_retry_backoff_base = NO_OFFLINE_RETRY;
+/* Change state of a counter slot, kept beside the counters */
+struct slot_change {
+	unsigned long long gen;		/* of the last change, 0: none */
+	int newer, older;		/* change list, -1 terminated */
+};
+
+static struct slot_change *slot_changes;
+static int newest_slot = -1;
+
+/* Place of a counter slot in the expiry queue of its cluster */
+struct slot_expire {
+	unsigned char sooner, later;	/* NO_SLOT terminated */
+};
+
+static struct slot_expire *slot_expires;
+
+/* Pages whose counter went away, for dumps of changes */
+#define REMOVED_LOG 256
+static struct {
+	u64 addr;
+	unsigned long long gen;
+} removed_log[REMOVED_LOG];
+static unsigned removed_next;
+static unsigned long long removed_lost;	/* newest generation dropped from the log */
 
 static const char *page_state[] = {
 	[PAGE_ONLINE] = "online",
@@ -90,106 +146,445 @@ static const char *page_state[] = {
 	[PAGE_OFFLINE_FAILED] = "offline-failed",
 };
 
+static struct mempage *slot_mempage(unsigned slot);
+static void page_expired(struct wheel_timer *t, time_t now);
+
 static struct mempage *mempage_alloc(void)
 {
+	struct mempage *mp;
+
+	if (num_free_slots > 0) {
+		mp = slot_mempage(free_slots[--num_free_slots]);
+		memset(mp, 0, sizeof(struct mempage));
+		return mp;
+	}
 	if (!mp_cluster || mp_cluster->mp_used == N) {
 		mp_cluster = mmap(0, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 		if (mp_cluster == MAP_FAILED)
 			Enomem();
+		mp_clusters = xrealloc(mp_clusters, (num_clusters + 1) * sizeof(void *));
+		slot_changes = xrealloc(slot_changes, (num_clusters + 1) * N * sizeof(struct slot_change));
+		memset(&slot_changes[num_clusters * N], 0, N * sizeof(struct slot_change));
+		slot_expires = xrealloc(slot_expires, (num_clusters + 1) * N * sizeof(struct slot_expire));
+		memset(&slot_expires[num_clusters * N], NO_SLOT, N * sizeof(struct slot_expire));
+		mp_cluster->num = num_clusters;
+		mp_cluster->expire.fn = page_expired;
+		mp_cluster->first = mp_cluster->last = NO_SLOT;
+		mp_clusters[num_clusters++] = mp_cluster;
 	}
 
 	return &mp_cluster->mp[mp_cluster->mp_used++];
 }
 
+static unsigned mempage_slot(struct mempage *mp)
+{
+	struct mempage_cluster *mc = to_cluster(mp);
+
+	return mc->num * N + (mp - mc->mp);
+}
+
+static struct mempage *slot_mempage(unsigned slot)
+{
+	return &mp_clusters[slot / N]->mp[slot % N];
+}
+
 static struct mempage *mempage_replace(void)
 {
 	struct mempage *mp;
 
-	/* If no free mp_cluster, reuse the last mp_cluster of the LRU list  */
-	if (mp_cluster->mp_used == N) {
-		mp_cluster = list_last_entry(&mempage_cluster_lru_list, struct mempage_cluster, lru);
-		mp_cluster->mp_used = 0;
+	/* Give referenced counters a second chance, take the first unreferenced one */
+	for (;;) {
+		mp = slot_mempage(clock_hand);
+		if (++clock_hand == (unsigned)corr_err_counters)
+			clock_hand = 0;
+		if (!mp->referenced)
+			break;
+		mp->referenced = 0;
 	}
 
-	mp = &mp_cluster->mp[mp_cluster->mp_used++];
 	mp->offlined = PAGE_ONLINE;
 	mp->triggered = 0;
 	mp->offline_threshold_multiplier = NO_OFFLINE_RETRY;
-	mp->ce.count = 0;
+	mp->count = 0;
 
 	return mp;
 }
 
-static struct mempage *mempage_lookup(u64 addr)
+/* Returns the chunk that holds pfn or where it belongs, or -1 without chunks */
+static int chunk_find(u64 pfn)
 {
-	struct rb_node *n = mempage_root.rb_node;
+	unsigned lo = 0, hi = num_chunks;
 
-	while (n) {
-		struct mempage *mp = rb_entry(n, struct mempage, nd);
+	if (num_chunks == 0)
+		return -1;
+	/* The last chunk starting at or below pfn, else the first */
+	while (hi - lo > 1) {
+		unsigned mid = (lo + hi) / 2;
 
-		if (addr < mp->addr)
-			n = n->rb_left;
-		else if (addr > mp->addr)
-			n = n->rb_right;
+		if ((index_chunks[mid]->key[0] >> SLOT_BITS) <= pfn)
+			lo = mid;
 		else
-			return mp;
+			hi = mid;
 	}
-	return NULL;
+	return lo;
 }
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Waddress-of-packed-member"
-
-static struct mempage *
-mempage_insert_lookup(u64 addr, struct rb_node * node)
+/* Binary search a chunk. Returns the position of pfn or where it belongs */
+static unsigned key_find(struct index_chunk *ch, u64 pfn)
 {
-	struct rb_node **p = &mempage_root.rb_node;
-	struct rb_node *parent = NULL;
-	struct mempage *mp;
+	unsigned lo = 0, hi = ch->len;
 
-	while (*p) {
-		parent = *p;
-		mp = rb_entry(parent, struct mempage, nd);
+	while (lo < hi) {
+		unsigned mid = (lo + hi) / 2;
 
-		if (addr < mp->addr)
-			p = &(*p)->rb_left;
-		else if (addr > mp->addr)
-			p = &(*p)->rb_right;
+		if ((ch->key[mid] >> SLOT_BITS) < pfn)
+			lo = mid + 1;
 		else
-			return mp;
+			hi = mid;
 	}
-	rb_link_node(node, parent, p);
-	rb_insert_color(node, &mempage_root);
+	return lo;
+}
+
+static struct mempage *mempage_lookup(u64 addr)
+{
+	u64 pfn = addr >> PAGE_SHIFT;
+	int c = chunk_find(pfn);
+	struct index_chunk *ch;
+	unsigned i;
+
+	if (c < 0)
+		return NULL;
+	ch = index_chunks[c];
+	i = key_find(ch, pfn);
+	if (i < ch->len && KEY_ADDR(ch->key[i]) == addr)
+		return slot_mempage(KEY_SLOT(ch->key[i]));
 	return NULL;
 }
 
-#pragma GCC diagnostic pop
+static void chunk_add(unsigned c, struct index_chunk *ch)
+{
+	if (num_chunks == chunks_size) {
+		chunks_size = chunks_size ? chunks_size * 2 : 16;
+		index_chunks = xrealloc(index_chunks, chunks_size * sizeof(void *));
+	}
+	memmove(&index_chunks[c + 1], &index_chunks[c],
+		(num_chunks - c) * sizeof(void *));
+	index_chunks[c] = ch;
+	num_chunks++;
+}
 
-static struct mempage *mempage_insert(u64 addr, struct mempage *mp)
+static void chunk_del(unsigned c)
 {
-	mp->addr = addr;
-	mp = mempage_insert_lookup(addr, &mp->nd);
-	return mp;
+	free(index_chunks[c]);
+	memmove(&index_chunks[c], &index_chunks[c + 1],
+		(num_chunks - c - 1) * sizeof(void *));
+	num_chunks--;
 }
 
-static void mempage_rb_tree_update(u64 addr, struct mempage *mp)
+static void index_insert(u64 key)
 {
-	rb_erase(&mp->nd, &mempage_root);
-	mempage_insert(addr, mp);
+	u64 pfn = key >> SLOT_BITS;
+	int c = chunk_find(pfn);
+	struct index_chunk *ch;
+	unsigned i;
+
+	if (c < 0) {
+		c = 0;
+		chunk_add(0, xalloc(sizeof(struct index_chunk)));
+	}
+	ch = index_chunks[c];
+	i = key_find(ch, pfn);
+	/* Split a full chunk in half */
+	if (ch->len == INDEX_CHUNK) {
+		struct index_chunk *nch = xalloc(sizeof(struct index_chunk));
+
+		nch->len = INDEX_CHUNK / 2;
+		ch->len -= nch->len;
+		memcpy(nch->key, &ch->key[ch->len], nch->len * sizeof(u64));
+		chunk_add(c + 1, nch);
+		if (i > ch->len) {
+			i -= ch->len;
+			ch = nch;
+		}
+	}
+	memmove(&ch->key[i + 1], &ch->key[i], (ch->len - i) * sizeof(u64));
+	ch->key[i] = key;
+	ch->len++;
+}
+
+static void mempage_insert(u64 addr, struct mempage *mp)
+{
+	index_insert(KEY(addr, mempage_slot(mp)));
+}
+
+static void mempage_remove(u64 addr)
+{
+	u64 pfn = addr >> PAGE_SHIFT;
+	int c = chunk_find(pfn);
+	struct index_chunk *ch, *next;
+	unsigned i;
+
+	if (c < 0)
+		return;
+	ch = index_chunks[c];
+	i = key_find(ch, pfn);
+	if (i == ch->len || KEY_ADDR(ch->key[i]) != addr)
+		return;
+	memmove(&ch->key[i], &ch->key[i + 1], (ch->len - i - 1) * sizeof(u64));
+	ch->len--;
+	if (ch->len == 0) {
+		chunk_del(c);
+		return;
+	}
+	/* Merge a small chunk into its predecessor or its successor */
+	if (ch->len >= INDEX_CHUNK / 4)
+		return;
+	if (c > 0 && index_chunks[c - 1]->len + ch->len <= INDEX_CHUNK / 2) {
+		ch = index_chunks[--c];
+	} else if (c + 1 == (int)num_chunks ||
+		   index_chunks[c + 1]->len + ch->len > INDEX_CHUNK / 2)
+		return;
+	next = index_chunks[c + 1];
+	memcpy(&ch->key[ch->len], next->key, next->len * sizeof(u64));
+	ch->len += next->len;
+	chunk_del(c + 1);
+}
+
+/* Does key keep the order at position i of chunk c? */
+static int key_fits(unsigned c, unsigned i, u64 key)
+{
+	struct index_chunk *ch = index_chunks[c];
+
+	if (i > 0 ? ch->key[i - 1] > key :
+	    c > 0 && index_chunks[c - 1]->key[index_chunks[c - 1]->len - 1] > key)
+		return 0;
+	if (i + 1 < ch->len ? ch->key[i + 1] < key :
+	    c + 1 < num_chunks && index_chunks[c + 1]->key[0] < key)
+		return 0;
+	return 1;
+}
+
+/* 
+ * Move a recycled counter to a new page, returns the old page. When the
+ * new page sorts at the same position the key is overwritten in place.
+ */
+static u64 mempage_index_update(u64 addr, struct mempage *mp)
+{
+	u64 old = mp->addr, key = KEY(addr, mempage_slot(mp));
+	int c = chunk_find(old >> PAGE_SHIFT);
+	unsigned i = key_find(index_chunks[c], old >> PAGE_SHIFT);
+
+	if (key_fits(c, i, key)) {
+		index_chunks[c]->key[i] = key;
+		return old;
+	}
+	mempage_remove(old);
+	index_insert(key);
+	return old;
+}
+
+static void slot_unlink(int i)
+{
+	struct slot_change *sc = &slot_changes[i];
+
+	if (!sc->gen)
+		return;
+	if (sc->newer >= 0)
+		slot_changes[sc->newer].older = sc->older;
+	else
+		newest_slot = sc->older;
+	if (sc->older >= 0)
+		slot_changes[sc->older].newer = sc->newer;
+	sc->gen = 0;
+}
+
+/* Move a changed counter to the front of the change list */
+static void mempage_changed(struct mempage *mp)
+{
+	int i = mempage_slot(mp);
+	struct slot_change *sc = &slot_changes[i];
+
+	slot_unlink(i);
+	sc->newer = -1;
+	sc->older = newest_slot;
+	if (newest_slot >= 0)
+		slot_changes[newest_slot].newer = i;
+	newest_slot = i;
+	sc->gen = ++error_gen;
+}
+
+/* The counter of addr is gone or counts another page now */
+static void mempage_removed(struct mempage *mp, u64 addr)
+{
+	unsigned i = removed_next++ % REMOVED_LOG;
+
+	slot_unlink(mempage_slot(mp));
+	if (removed_log[i].gen)
+		removed_lost = removed_log[i].gen;
+	removed_log[i].addr = addr;
+	removed_log[i].gen = ++error_gen;
+}
+
+static void page_save(u64 addr, struct mempage *mp, struct mce *m, int channel,
+		      int dimm)
+{
+	struct db_page d = {
+		.count = mp->count,
+		.offlined = mp->offlined,
+		.triggered = mp->triggered,
+		.offline_threshold_multiplier = mp->offline_threshold_multiplier,
+		.socketid = m->socketid,
+		.channel = channel,
+		.dimm = dimm,
+		.last = m->time ? (time_t)m->time : bucket_time(),
+	};
+
+	d.first = diskdb_first(DB_PAGE, addr, 0, sizeof(d), d.last);
+	diskdb_bucket(&d.bucket, &mp->bucket);
+	mempage_changed(mp);
+	diskdb_put(DB_PAGE, addr, 0, &d, sizeof(d));
+	stats_changed();
+}
+
+static struct slot_expire *cluster_expire(struct mempage_cluster *mc, int i)
+{
+	return &slot_expires[mc->num * N + i];
+}
+
+static time_t page_drained(struct mempage *mp)
+{
+	return bucket_drained(&page_trigger_conf, &mp->bucket,
+			      mp->offline_threshold_multiplier);
 }
 
-static void mempage_cluster_lru_list_insert(struct mempage_cluster *mp_cluster)
+static void expire_unlink(struct mempage_cluster *mc, int i)
 {
-	list_add(&mp_cluster->lru, &mempage_cluster_lru_list);
+	struct slot_expire *se = cluster_expire(mc, i);
+
+	if (mc->first != i && se->sooner == NO_SLOT)
+		return;
+	if (se->sooner != NO_SLOT)
+		cluster_expire(mc, se->sooner)->later = se->later;
+	else
+		mc->first = se->later;
+	if (se->later != NO_SLOT)
+		cluster_expire(mc, se->later)->sooner = se->sooner;
+	else
+		mc->last = se->sooner;
+	se->sooner = se->later = NO_SLOT;
+}
+
+/* Queue a counter after the ones draining no later, usually at the end */
+static void expire_queue(struct mempage_cluster *mc, int i, time_t t)
+{
+	struct slot_expire *se = cluster_expire(mc, i);
+	int k = mc->last;
+
+	while (k != NO_SLOT && page_drained(&mc->mp[k]) > t)
+		k = cluster_expire(mc, k)->sooner;
+	se->sooner = k;
+	if (k == NO_SLOT) {
+		se->later = mc->first;
+		mc->first = i;
+	} else {
+		se->later = cluster_expire(mc, k)->later;
+		cluster_expire(mc, k)->later = i;
+	}
+	if (se->later != NO_SLOT)
+		cluster_expire(mc, se->later)->sooner = i;
+	else
+		mc->last = i;
 }
 
-static void mempage_cluster_lru_list_update(struct mempage_cluster *mp_cluster)
+static void expire_arm(struct mempage_cluster *mc)
 {
-	if (list_is_first(&mp_cluster->lru, &mempage_cluster_lru_list))
+	time_t t;
+
+	if (mc->first == NO_SLOT) {
+		wheel_del(&mc->expire);
 		return;
+	}
+	t = page_drained(&mc->mp[mc->first]);
+	if (!wheel_pending(&mc->expire) || mc->expire.expires != t)
+		wheel_add(&mc->expire, t);
+}
+
+/*
+ * A page counter whose bucket drained is not worth its slot unless it
+ * records an action on the page. Give the slot back before the counter
+ * limit forces replacing live counters.
+ */
+static void page_reclaim(struct mempage *mp)
+{
+	mempage_remove(mp->addr);
+	mempage_removed(mp, mp->addr);
+	diskdb_delete(DB_PAGE, mp->addr, 0);
+	free_slots = xrealloc(free_slots, (num_free_slots + 1) * sizeof(unsigned));
+	free_slots[num_free_slots++] = mempage_slot(mp);
+	corr_err_counters--;
+	stats_changed();
+}
+
+/* Reclaim the drained counters at the front of the cluster's queue */
+static void page_expired(struct wheel_timer *t, time_t now)
+{
+	struct mempage_cluster *mc = container_of(t, struct mempage_cluster, expire);
+
+	while (mc->first != NO_SLOT) {
+		struct mempage *mp = &mc->mp[mc->first];
+
+		if (page_drained(mp) > now)
+			break;
+		if (!bucket_expire(&page_trigger_conf, &mp->bucket, now,
+				   mp->offline_threshold_multiplier)) {
+			wheel_add(t, now + 1);
+			return;
+		}
+		expire_unlink(mc, mc->first);
+		page_reclaim(mp);
+	}
+	expire_arm(mc);
+}
 
-	list_del(&mp_cluster->lru);
-	list_add(&mp_cluster->lru, &mempage_cluster_lru_list);
+/* 
+ * Expire the page counter once its bucket has drained, unless it records
+ * an action on the page.
+ */
+static void page_schedule(struct mempage *mp)
+{
+	struct mempage_cluster *mc = to_cluster(mp);
+	int i = mp - mc->mp;
+	time_t t = page_drained(mp);
+
+	expire_unlink(mc, i);
+	if (t && mp->offlined == PAGE_ONLINE && !mp->triggered)
+		expire_queue(mc, i, t);
+	expire_arm(mc);
+}
+
+/* Restore a page counter from the database while there are free counters */
+void page_restore(uint64_t addr, const struct db_page *d)
+{
+	struct mempage *mp;
+
+	if (mempage_lookup(addr) || corr_err_counters >= max_corr_err_counters)
+		return;
+	mp = mempage_alloc();
+	mempage_insert(addr, mp);
+	corr_err_counters++;
+	mp->addr = addr;
+	mp->count = d->count;
+	mp->offlined = d->offlined;
+	mp->triggered = d->triggered;
+	mp->offline_threshold_multiplier = d->offline_threshold_multiplier;
+	diskdb_restore_bucket(&mp->bucket, &d->bucket);
+	page_schedule(mp);
+}
+
+void page_restore_replacement(const struct db_counter *d)
+{
+	mp_replacement.count = d->count;
+	diskdb_restore_bucket(&mp_replacement.bucket, &d->bucket);
 }
 
 /* Following arrays need to be all kept in sync with the enum */
@@ -255,11 +650,11 @@ static void counter_trigger(char *msg, time_t t, struct mempage_replacement *mr,
 			    struct bucket_conf *bc, bool sync)
 {
 	struct leaky_bucket *bk = &mr->bucket;
-	char *env[MAX_ENV], *out, *thresh;
-	int i, ei = 0;
+	char *out, *thresh;
 
 	thresh = bucket_output(bc, bk);
 	xasprintf(&out, "%s: %s", msg, thresh);
+	server_publish_threshold(out);
 
 	if (bc->log)
 		Gprintf("%s\n", out);
@@ -267,22 +662,16 @@ static void counter_trigger(char *msg, time_t t, struct mempage_replacement *mr,
 	if (!bc->trigger)
 		goto out;
 
-	xasprintf(&env[ei++], "THRESHOLD=%s", thresh);
-	xasprintf(&env[ei++], "TOTALCOUNT=%lu", mr->count);
+	trigger_env_start();
+	trigger_env_add("THRESHOLD=%s", thresh);
+	trigger_env_add("TOTALCOUNT=%u", mr->count);
 	if (t)
-		xasprintf(&env[ei++], "LASTEVENT=%lu", t);
-	xasprintf(&env[ei++], "AGETIME=%u", bc->agetime);
-	xasprintf(&env[ei++], "MESSAGE=%s", out);
-	xasprintf(&env[ei++], "THRESHOLD_COUNT=%d", bk->count);
-	env[ei] = NULL;
-	assert(ei < MAX_ENV);
-
-	run_trigger(bc->trigger, NULL, env, sync, "page-error-counter");
-
-	for (i = 0; i < ei; i++) {
-		free(env[i]);
-		env[i] = NULL;
-	}
+		trigger_env_add("LASTEVENT=%lu", t);
+	trigger_env_add("AGETIME=%u", bc->agetime);
+	trigger_env_add("MESSAGE=%s", out);
+	trigger_env_add("THRESHOLD_COUNT=%d", bk->count);
+
+	run_trigger(bc->trigger, NULL, trigger_env_finish(), sync, "page-error-counter");
 out:
 	free(out);
 	out = NULL;
@@ -325,16 +714,19 @@ void account_page_error(struct mce *m, int channel, int dimm)
 	mp = mempage_lookup(addr);
 	if (!mp && corr_err_counters < max_corr_err_counters) {
 		mp = mempage_alloc();
-		bucket_init(&mp->ce.bucket);
+		bucket_init(&mp->bucket);
 	        mempage_insert(addr, mp);
-		mempage_cluster_lru_list_insert(to_cluster(mp));
 		mp->offline_threshold_multiplier = NO_OFFLINE_RETRY;
 		corr_err_counters++;
 	} else if (!mp) {
+		struct db_counter d = {};
+		u64 old;
+
 		mp = mempage_replace();
-		bucket_init(&mp->ce.bucket);
-		mempage_rb_tree_update(addr, mp);
-		mempage_cluster_lru_list_update(to_cluster(mp));
+		bucket_init(&mp->bucket);
+		old = mempage_index_update(addr, mp);
+		mempage_removed(mp, old);
+		diskdb_delete(DB_PAGE, old, 0);
 
 		/* Report how often the replacement of counter 'mp' happened */
 		++mp_replacement.count;
@@ -348,24 +740,28 @@ void account_page_error(struct mce *m, int channel, int dimm)
 			free(msg);
 			msg = NULL;
 		}
-	} else {
-		mempage_cluster_lru_list_update(to_cluster(mp));
+		d.count = mp_replacement.count;
+		diskdb_bucket(&d.bucket, &mp_replacement.bucket);
+		diskdb_put(DB_PAGE_REPLACEMENT, 0, 0, &d, sizeof(d));
 	}
-	++mp->ce.count;
-	if (__bucket_account(&page_trigger_conf, &mp->ce.bucket, 1, t, mp->offline_threshold_multiplier)) {
+	mp->addr = addr;
+	mp->referenced = 1;
+	++mp->count;
+	if (__bucket_account(&page_trigger_conf, &mp->bucket, 1, t, mp->offline_threshold_multiplier)) {
 		struct memdimm *md;
 
 		if ((offline_retry_backoff_base == OFFLINE_RETRY_EXP_BACKOFF && mp->offlined == PAGE_OFFLINE) ||
 		    (offline_retry_backoff_base == NO_OFFLINE_RETRY && mp->offlined != PAGE_ONLINE))
-			return;
+			goto out;
 		/* Only do triggers and messages for online pages */
-		thresh = bucket_output(&page_trigger_conf, &mp->ce.bucket);
+		thresh = bucket_output(&page_trigger_conf, &mp->bucket);
 		md = get_memdimm(m->socketid, channel, dimm, 1);
 		xasprintf(&msg, "Corrected memory errors on page %llx exceed threshold %s",
 			addr, thresh);
 		free(thresh);
 		thresh = NULL;
-		memdb_trigger(msg, md, t, &mp->ce, &page_trigger_conf, NULL, false, "page");
+		memdb_trigger(msg, md, t, &mp->bucket, mp->count, &page_trigger_conf,
+			      NULL, false, "page");
 		free(msg);
 		msg = NULL;
 		mp->triggered = 1;
@@ -387,7 +783,8 @@ void account_page_error(struct mce *m, int channel, int dimm)
 			argv[0]=page_error_pre_soft_trigger;
 			argv[1]=args;
 			asprintf(&msg, "pre soft trigger run for page %lld", addr);
-			memdb_trigger(msg, md, t, &mp->ce, &page_soft_trigger_conf, argv, true, "page_pre_soft");
+			memdb_trigger(msg, md, t, &mp->bucket, mp->count,
+				      &page_soft_trigger_conf, argv, true, "page_pre_soft");
 			free(msg);
 			msg = NULL;
 
@@ -398,7 +795,8 @@ void account_page_error(struct mce *m, int channel, int dimm)
 			argv[0]=page_error_post_soft_trigger;
 			argv[1]=args;
 			asprintf(&msg, "post soft trigger run for page %lld", addr);
-			memdb_trigger(msg, md, t, &mp->ce, &page_soft_trigger_conf, argv, true, "page_post_soft");
+			memdb_trigger(msg, md, t, &mp->bucket, mp->count,
+				      &page_soft_trigger_conf, argv, true, "page_post_soft");
 			free(msg);
 			msg = NULL;
 			free(args);
@@ -406,31 +804,119 @@ void account_page_error(struct mce *m, int channel, int dimm)
 		} else
 			offline_action(mp, addr);
 	}
+out:
+	page_schedule(mp);
+	page_save(addr, mp, m, channel, dimm);
 }
 
-void dump_page_errors(FILE *f)
+static void dump_page_frame(FILE *f, u64 addr, struct mempage *p)
+{
+	struct mce_frame_page d = {
+		.addr = addr,
+		.count = p->count,
+		.offlined = p->offlined,
+		.triggered = p->triggered,
+	};
+
+	frame_bucket(&d.bucket, &p->bucket);
+	put_frame(f, MCE_FRAME_PAGE, &d, sizeof(d));
+}
+
+static void dump_page(FILE *f, int flags, u64 addr, struct mempage *p)
 {
 	char *msg;
-	struct rb_node *r;
-	long k;
-
-	k = 0;
-	for (r = rb_first(&mempage_root); r; r = rb_next(r)) { 
-		struct mempage *p = rb_entry(r, struct mempage, nd);
-
-		if (k++ == 0)
-			fprintf(f, "Per page corrected memory statistics:\n");
-		msg = bucket_output(&page_trigger_conf, &p->ce.bucket);
-		fprintf(f, "%llx: total %u seen \"%s\" %s%s\n",
-			p->addr,
-			p->ce.count,
-			msg,
-			page_state[(unsigned)p->offlined],
-			p->triggered ? " triggered" : "");
-		free(msg);
-		msg = NULL;
-		fputc('\n', f);
+
+	if (flags & DUMP_BINARY) {
+		dump_page_frame(f, addr, p);
+		return;
 	}
+	msg = bucket_output(&page_trigger_conf, &p->bucket);
+
+	fprintf(f, "%llx: total %u seen \"%s\" %s%s\n",
+		addr,
+		p->count,
+		msg,
+		page_state[(unsigned)p->offlined],
+		p->triggered ? " triggered" : "");
+	free(msg);
+	msg = NULL;
+	fputc('\n', f);
+}
+
+static int cmp_page_addr(const void *a, const void *b)
+{
+	const struct mempage *x = *(void **)a, *y = *(void **)b;
+
+	return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+/* 
+ * Dump the pages that changed after generation since, walking the change
+ * list back from the newest change, and the pages whose counter went
+ * away. Returns -1 when removals that old are forgotten, then only a
+ * full dump is correct.
+ */
+static int dump_page_changes(FILE *f, int flags, unsigned long long since)
+{
+	struct mempage **pa = NULL;
+	unsigned i, n = 0, max = 0;
+	int slot;
+
+	if (since < removed_lost)
+		return -1;
+	for (slot = newest_slot; slot >= 0 && slot_changes[slot].gen > since;
+	     slot = slot_changes[slot].older) {
+		if (n == max) {
+			max = max ? max * 2 : 64;
+			pa = xrealloc(pa, max * sizeof(void *));
+		}
+		pa[n++] = slot_mempage(slot);
+	}
+	qsort(pa, n, sizeof(void *), cmp_page_addr);
+	if (!(flags & DUMP_BINARY))
+		fprintf(f, "Per page corrected memory changes:\n");
+	/* Before the changes, a page may have come back after its removal */
+	for (i = 0; i < REMOVED_LOG; i++) {
+		if (removed_log[i].gen <= since)
+			continue;
+		if (flags & DUMP_BINARY)
+			put_frame(f, MCE_FRAME_PAGE_REMOVED, &removed_log[i].addr,
+				  sizeof(uint64_t));
+		else
+			fprintf(f, "%llx: removed\n\n", removed_log[i].addr);
+	}
+	for (i = 0; i < n; i++)
+		dump_page(f, flags, pa[i]->addr, pa[i]);
+	free(pa);
+	return 0;
+}
+
+/* A binary full dump starts with MCE_FRAME_PAGES_RESET */
+void dump_page_errors(FILE *f, int flags, unsigned long long since)
+{
+	unsigned c, i;
+
+	if (since && dump_page_changes(f, flags, since) == 0)
+		return;
+	if (flags & DUMP_BINARY)
+		put_frame(f, MCE_FRAME_PAGES_RESET, NULL, 0);
+	if (num_chunks > 0 && !(flags & DUMP_BINARY))
+		fprintf(f, "Per page corrected memory statistics:\n");
+	for (c = 0; c < num_chunks; c++) {
+		struct index_chunk *ch = index_chunks[c];
+
+		for (i = 0; i < ch->len; i++)
+			dump_page(f, flags, KEY_ADDR(ch->key[i]),
+				  slot_mempage(KEY_SLOT(ch->key[i])));
+	}
+}
+
+void page_stats(struct stats_header *h)
+{
+	h->page_counters = corr_err_counters;
+	h->page_counters_max = max_corr_err_counters;
+	h->replacements = mp_replacement.count;
+	stats_bucket(&h->replacement_bucket, &mp_replacement.bucket);
 }
 
 void page_setup(void)
@@ -466,6 +952,11 @@ void page_setup(void)
 	}
 
 	n = max_corr_err_counters;
+	if (max_corr_err_counters > (int)(MAX_SLOTS - N)) {
+		max_corr_err_counters = MAX_SLOTS - N;
+		Lprintf("Limit max-corr-err-counters to %d\n", max_corr_err_counters);
+		n = max_corr_err_counters;
+	}
 	max_corr_err_counters = roundup(max_corr_err_counters, N);
 	if (n != max_corr_err_counters)
 		Lprintf("Round up max-corr-err-counters from %d to %d\n", n, max_corr_err_counters);
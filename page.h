@@ -3,7 +3,7 @@
 
 struct memdimm;
 void account_page_error(struct mce *m, int channel, int dimm);
-void dump_page_errors(FILE *);
+void dump_page_errors(FILE *, int flags, unsigned long long since);
 void page_setup(void);
 
 
@@ -0,0 +1,207 @@
+/* Parallel decoding of bulk input.
+   The input is parsed sequentially into items, which are collected in
+   chunks. Worker threads decode whole chunks into per thread output
+   batches, and the thread queueing the items writes the batches out in
+   input order. The number of chunks in flight is bounded, so memory use
+   does not depend on the input size.
+
+   mcelog is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; version
+   2.
+
+   mcelog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should find a copy of v2 of the GNU General Public License somewhere
+   on your Linux system; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA */
+#define _GNU_SOURCE 1
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "mcelog.h"
+#include "memutil.h"
+#include "msg.h"
+#include "parallel.h"
+#include "record.h"
+
+#define CHUNK_ITEMS 256
+
+struct chunk {
+	struct chunk *next;
+	char *items;
+	unsigned n;
+	int done;
+	char *out;
+	size_t outlen;
+	char *rec;		/* structured records */
+	size_t reclen;
+};
+
+int parallel_jobs = 1;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static struct chunk *head, *tail;	/* queued chunks in input order */
+static struct chunk *next_work;		/* first chunk no worker took yet */
+static struct chunk *cur;		/* chunk being filled */
+static struct chunk *free_chunks;
+static int queued, max_queued;
+static int stopping;
+static pthread_t *threads;
+static size_t item_size;
+static parallel_fn decode;
+
+static void *worker(void *arg)
+{
+	struct chunk *c;
+	unsigned i;
+
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		while (!next_work && !stopping)
+			pthread_cond_wait(&work_cond, &lock);
+		c = next_work;
+		if (!c)
+			break;
+		next_work = c->next;
+		pthread_mutex_unlock(&lock);
+
+		startbatch();
+		record_startbatch();
+		for (i = 0; i < c->n; i++)
+			decode(c->items + i * item_size);
+		c->out = takebatch(&c->outlen);
+		c->rec = record_takebatch(&c->reclen);
+
+		pthread_mutex_lock(&lock);
+		c->done = 1;
+		pthread_cond_signal(&done_cond);
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+enum { WRITE_DONE, WRITE_ONE, WRITE_ALL };
+
+/* Write out decoded chunks at the head of the queue. Called with lock held */
+static void write_done(int wait)
+{
+	struct chunk *c;
+
+	while ((c = head) != NULL) {
+		if (!c->done) {
+			if (wait == WRITE_DONE)
+				break;
+			pthread_cond_wait(&done_cond, &lock);
+			continue;
+		}
+		head = c->next;
+		if (!head)
+			tail = NULL;
+		queued--;
+		pthread_mutex_unlock(&lock);
+		writebatch(c->out, c->outlen);
+		free(c->out);
+		c->out = NULL;
+		record_writebatch(c->rec, c->reclen);
+		free(c->rec);
+		c->rec = NULL;
+		c->next = free_chunks;
+		free_chunks = c;
+		pthread_mutex_lock(&lock);
+		if (wait == WRITE_ONE)
+			break;
+	}
+}
+
+static void submit(void)
+{
+	struct chunk *c = cur;
+
+	cur = NULL;
+	c->next = NULL;
+	c->done = 0;
+	pthread_mutex_lock(&lock);
+	if (tail)
+		tail->next = c;
+	else
+		head = c;
+	tail = c;
+	if (!next_work)
+		next_work = c;
+	queued++;
+	pthread_cond_signal(&work_cond);
+	write_done(WRITE_DONE);
+	if (queued >= max_queued)
+		write_done(WRITE_ONE);
+	pthread_mutex_unlock(&lock);
+}
+
+void parallel_start(parallel_fn fn, size_t itemsize)
+{
+	int i;
+
+	decode = fn;
+	item_size = itemsize;
+	stopping = 0;
+	max_queued = parallel_jobs * 2 + 2;
+	threads = xalloc(parallel_jobs * sizeof(pthread_t));
+	for (i = 0; i < parallel_jobs; i++) {
+		if (pthread_create(&threads[i], NULL, worker, NULL))
+			err("pthread_create");
+	}
+}
+
+/* Return room for the next item. It is decoded after the next call */
+void *parallel_item(void)
+{
+	if (cur && cur->n == CHUNK_ITEMS)
+		submit();
+	if (!cur) {
+		cur = free_chunks;
+		if (cur)
+			free_chunks = cur->next;
+		else {
+			cur = xalloc(sizeof(struct chunk));
+			cur->items = xalloc_nonzero(CHUNK_ITEMS * item_size);
+		}
+		cur->n = 0;
+	}
+	return cur->items + cur->n++ * item_size;
+}
+
+/* Decode and write out everything queued and stop the workers */
+void parallel_finish(void)
+{
+	struct chunk *c;
+	int i;
+
+	if (cur && cur->n > 0)
+		submit();
+	pthread_mutex_lock(&lock);
+	write_done(WRITE_ALL);
+	stopping = 1;
+	pthread_cond_broadcast(&work_cond);
+	pthread_mutex_unlock(&lock);
+	for (i = 0; i < parallel_jobs; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	threads = NULL;
+
+	if (cur) {
+		cur->next = free_chunks;
+		free_chunks = cur;
+		cur = NULL;
+	}
+	while ((c = free_chunks) != NULL) {
+		free_chunks = c->next;
+		free(c->items);
+		free(c);
+	}
+}
@@ -0,0 +1,14 @@
+#include <stddef.h>
+
+/*
+ * Decode queued items on worker threads. The output each thread writes
+ * while decoding goes into its own batch and is written out in the order
+ * the items were queued.
+ */
+typedef void (*parallel_fn)(void *item);
+
+extern int parallel_jobs;
+
+void parallel_start(parallel_fn fn, size_t itemsize);
+void *parallel_item(void);
+void parallel_finish(void);
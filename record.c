@@ -0,0 +1,402 @@
+/* Structured machine check records for machine processing.
+   The decoders fill in a typed record that is written as JSON lines
+   or as a binary TLV stream.
+
+   mcelog is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; version
+   2.
+
+   mcelog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should find a copy of v2 of the GNU General Public License somewhere
+   on your Linux system; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA */
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "mcelog.h"
+#include "memutil.h"
+#include "intel.h"
+#include "config.h"
+#include "msg.h"
+#include "record.h"
+
+#define MAX_RECORD_FIELDS 32
+
+struct record_field {
+	const char *name;	/* NULL: unknown value */
+	unsigned start_bit;
+	u64 val;
+	int num;		/* from a numfield */
+};
+
+struct mce_record {
+	struct mce *m;
+	unsigned recordlen;
+	int nfields;
+	struct record_field fields[MAX_RECORD_FIELDS];
+	char *mca_text;
+	char *model_text;
+};
+
+enum record_format record_format = RECORD_OFF;
+char *record_file;
+__thread int record_open;
+
+static FILE *record_fh;
+/* Per decoding thread, the records of a parallel batch go to batch_fh */
+static __thread struct mce_record rec;
+static __thread FILE *batch_fh;
+static __thread char *batch_buf;
+static __thread size_t batch_len;
+
+static struct config_choice record_formats[] = {
+	{ "json", RECORD_JSON },
+	{ "binary", RECORD_BINARY },
+	{}
+};
+
+int record_set_format(char *s)
+{
+	struct config_choice *c;
+
+	for (c = record_formats; c->name; c++) {
+		if (!strcasecmp(s, c->name)) {
+			record_format = c->val;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* Open the record output. Without a record file records replace the text output */
+void record_setup(void)
+{
+	if (record_format == RECORD_OFF || record_fh)
+		return;
+	if (record_file) {
+		record_fh = fopen(record_file, "a");
+		if (!record_fh) {
+			SYSERRprintf("Cannot open record file `%s'", record_file);
+			exit(1);
+		}
+	} else {
+		record_fh = stdout;
+		wprintf_quiet = 1;
+	}
+}
+
+void record_begin(struct mce *m, unsigned recordlen)
+{
+	if (!record_fh)
+		return;
+	rec.m = m;
+	rec.recordlen = recordlen;
+	rec.nfields = 0;
+	record_open = 1;
+}
+
+/* Collect the decoded text up to record_text_end() into the record */
+void record_text_begin(void)
+{
+	if (record_open)
+		capture_start();
+}
+
+void record_text_end(enum record_tlv type)
+{
+	char **text = type == REC_MCA_TEXT ? &rec.mca_text : &rec.model_text;
+	char *s;
+	size_t len;
+
+	if (!record_open)
+		return;
+	s = capture_end();
+	len = strlen(s);
+	while (len > 0 && (s[len - 1] == '\n' || s[len - 1] == ' '))
+		len--;
+	if (len == 0)
+		return;
+	free(*text);
+	*text = xalloc_nonzero(len + 1);
+	memcpy(*text, s, len);
+	(*text)[len] = 0;
+}
+
+static struct record_field *new_field(void)
+{
+	if (rec.nfields >= MAX_RECORD_FIELDS)
+		return NULL;
+	return &rec.fields[rec.nfields++];
+}
+
+void record_field(const char *name)
+{
+	struct record_field *f = new_field();
+
+	if (f) {
+		f->name = name;
+		f->num = 0;
+	}
+}
+
+void record_unknown_field(unsigned start_bit, u64 v)
+{
+	struct record_field *f = new_field();
+
+	if (f) {
+		f->name = NULL;
+		f->start_bit = start_bit;
+		f->val = v;
+		f->num = 0;
+	}
+}
+
+void record_numfield(const char *name, u64 v)
+{
+	struct record_field *f = new_field();
+
+	if (f) {
+		f->name = name;
+		f->val = v;
+		f->num = 1;
+	}
+}
+
+static void json_string(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(f, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(f, "\\u%04x", *s);
+		else
+			fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+static void write_json(FILE *f, struct mce *m, int nmem, int *channel, int *dimm)
+{
+	int i, k;
+
+	fprintf(f, "{\"cpu\":%u,\"bank\":%u", m->extcpu ? m->extcpu : m->cpu, m->bank);
+	if (rec.recordlen > offsetof(struct mce, socketid))
+		fprintf(f, ",\"socket\":%u", m->socketid);
+	fprintf(f, ",\"status\":\"0x%llx\",\"mcgstatus\":\"0x%llx\"", m->status, m->mcgstatus);
+	if (m->status & MCI_STATUS_MISCV)
+		fprintf(f, ",\"misc\":\"0x%llx\"", m->misc);
+	if (m->status & MCI_STATUS_ADDRV)
+		fprintf(f, ",\"addr\":\"0x%llx\"", m->addr);
+	if (m->time)
+		fprintf(f, ",\"time\":%llu", m->time);
+	fprintf(f, ",\"mcacod\":\"0x%x\",\"mscod\":\"0x%x\"",
+		(unsigned)(m->status & 0xffff), (unsigned)((m->status >> 16) & 0xffff));
+	if (nmem > 0) {
+		fprintf(f, ",\"dimms\":[");
+		for (i = 0; i < nmem; i++)
+			fprintf(f, "%s{\"channel\":%d,\"dimm\":%d}", i ? "," : "",
+				channel[i], dimm[i]);
+		fputc(']', f);
+	}
+	fprintf(f, ",\"fields\":[");
+	for (i = 0, k = 0; i < rec.nfields; i++) {
+		struct record_field *rf = &rec.fields[i];
+		if (rf->num)
+			continue;
+		if (k++)
+			fputc(',', f);
+		if (rf->name)
+			json_string(f, rf->name);
+		else
+			fprintf(f, "\"<%u:%llx>\"", rf->start_bit, rf->val);
+	}
+	fprintf(f, "],\"values\":{");
+	for (i = 0, k = 0; i < rec.nfields; i++) {
+		struct record_field *rf = &rec.fields[i];
+		if (!rf->num)
+			continue;
+		if (k++)
+			fputc(',', f);
+		json_string(f, rf->name);
+		fprintf(f, ":%llu", rf->val);
+	}
+	fputc('}', f);
+	if (rec.mca_text) {
+		fprintf(f, ",\"mca\":");
+		json_string(f, rec.mca_text);
+	}
+	if (rec.model_text) {
+		fprintf(f, ",\"model\":");
+		json_string(f, rec.model_text);
+	}
+	fprintf(f, "}\n");
+}
+
+struct tlvbuf {
+	char *buf;
+	size_t len;
+	size_t size;
+};
+
+static void tlv_put(struct tlvbuf *t, unsigned type, const void *v, size_t len,
+		    const void *v2, size_t len2)
+{
+	u16 hdr[2] = { type, len + len2 };
+
+	if (t->len + sizeof(hdr) + len + len2 > t->size) {
+		t->size = (t->size + sizeof(hdr) + len + len2) * 2;
+		t->buf = xrealloc(t->buf, t->size);
+	}
+	memcpy(t->buf + t->len, hdr, sizeof(hdr));
+	t->len += sizeof(hdr);
+	memcpy(t->buf + t->len, v, len);
+	t->len += len;
+	if (len2) {
+		memcpy(t->buf + t->len, v2, len2);
+		t->len += len2;
+	}
+}
+
+#define TLV(t, type, val) tlv_put(t, type, &(val), sizeof(val), NULL, 0)
+
+/* TLV lengths are 16 bit, cut a text to what still fits into the record */
+static void tlv_text(struct tlvbuf *t, unsigned type, const char *s)
+{
+	size_t len = strlen(s);
+	size_t room = REC_MAX_LEN - 2*sizeof(u16) - t->len;
+
+	if (t->len + 2*sizeof(u16) > REC_MAX_LEN)
+		return;
+	if (len > room)
+		len = room;
+	tlv_put(t, type, s, len, NULL, 0);
+}
+
+static void write_binary(FILE *f, struct mce *m, int nmem, int *channel, int *dimm)
+{
+	static __thread struct tlvbuf t;
+	u32 cpu = m->extcpu ? m->extcpu : m->cpu;
+	u32 bank = m->bank;
+	u16 mcacod = m->status & 0xffff;
+	u16 mscod = (m->status >> 16) & 0xffff;
+	u16 hdr[2];
+	int i;
+
+	t.len = 0;
+	TLV(&t, REC_CPU, cpu);
+	TLV(&t, REC_BANK, bank);
+	if (rec.recordlen > offsetof(struct mce, socketid))
+		TLV(&t, REC_SOCKET, m->socketid);
+	TLV(&t, REC_STATUS, m->status);
+	TLV(&t, REC_MCGSTATUS, m->mcgstatus);
+	if (m->status & MCI_STATUS_MISCV)
+		TLV(&t, REC_MISC, m->misc);
+	if (m->status & MCI_STATUS_ADDRV)
+		TLV(&t, REC_ADDR, m->addr);
+	if (m->time)
+		TLV(&t, REC_TIME, m->time);
+	TLV(&t, REC_MCACOD, mcacod);
+	TLV(&t, REC_MSCOD, mscod);
+	for (i = 0; i < nmem; i++) {
+		TLV(&t, REC_CHANNEL, channel[i]);
+		TLV(&t, REC_DIMM, dimm[i]);
+	}
+	for (i = 0; i < rec.nfields; i++) {
+		struct record_field *rf = &rec.fields[i];
+		if (rf->num)
+			tlv_put(&t, REC_NUMFIELD, &rf->val, sizeof(u64),
+				rf->name, strlen(rf->name));
+		else if (rf->name)
+			tlv_put(&t, REC_FIELD, rf->name, strlen(rf->name), NULL, 0);
+		else {
+			u32 bit = rf->start_bit;
+			tlv_put(&t, REC_UNKNOWN_FIELD, &bit, sizeof(u32),
+				&rf->val, sizeof(u64));
+		}
+	}
+	if (rec.mca_text)
+		tlv_text(&t, REC_MCA_TEXT, rec.mca_text);
+	if (rec.model_text)
+		tlv_text(&t, REC_MODEL_TEXT, rec.model_text);
+	hdr[0] = REC_RECORD;
+	hdr[1] = t.len;
+	fwrite(hdr, sizeof(hdr), 1, f);
+	fwrite(t.buf, t.len, 1, f);
+}
+
+/* Write out the record collected for the current machine check */
+void record_end(void)
+{
+	struct mce *m = rec.m;
+	FILE *f = batch_fh ? batch_fh : record_fh;
+	int channel[2], dimm[2];
+	int nmem = 0;
+
+	if (!record_open)
+		return;
+	record_open = 0;
+
+	if (cputype >= CPU_INTEL && intel_memerr_location(m, channel, dimm))
+		nmem = channel[1] != -1 ? 2 : 1;
+
+	if (record_format == RECORD_JSON)
+		write_json(f, m, nmem, channel, dimm);
+	else
+		write_binary(f, m, nmem, channel, dimm);
+	free(rec.mca_text);
+	rec.mca_text = NULL;
+	free(rec.model_text);
+	rec.model_text = NULL;
+}
+
+void record_flush(void)
+{
+	if (record_fh && !batch_fh)
+		fflush(record_fh);
+}
+
+/* Collect the records of this thread until record_takebatch() */
+void record_startbatch(void)
+{
+	if (!record_fh)
+		return;
+	batch_fh = open_memstream(&batch_buf, &batch_len);
+	if (!batch_fh)
+		Enomem();
+}
+
+/* Return the collected records, which the caller frees */
+char *record_takebatch(size_t *len)
+{
+	char *buf;
+
+	*len = 0;
+	if (!batch_fh)
+		return NULL;
+	if (ferror(batch_fh) || fclose(batch_fh) != 0)
+		Enomem();
+	batch_fh = NULL;
+	buf = batch_buf;
+	*len = batch_len;
+	batch_buf = NULL;
+	batch_len = 0;
+	return buf;
+}
+
+/* Write out records of a batch in input order */
+void record_writebatch(char *buf, size_t len)
+{
+	if (!record_fh)
+		return;
+	if (len > 0)
+		fwrite(buf, len, 1, record_fh);
+	fflush(record_fh);
+}
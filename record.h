@@ -0,0 +1,60 @@
+#ifndef RECORD_H
+#define RECORD_H 1
+
+/* Structured error records written next to (or instead of) the decoded text */
+
+enum record_format {
+	RECORD_OFF,
+	RECORD_JSON,
+	RECORD_BINARY,
+};
+
+/*
+ * Binary records are a stream of TLVs in host byte order:
+ * u16 type, u16 length, then length bytes of value.
+ * Each record starts with a REC_RECORD TLV whose value holds all
+ * the other TLVs of the record. Texts that do not fit into the
+ * REC_MAX_LEN bytes of a record are cut.
+ */
+#define REC_MAX_LEN 0xffff
+
+enum record_tlv {
+	REC_RECORD = 1,
+	REC_CPU,		/* u32 */
+	REC_BANK,		/* u32 */
+	REC_SOCKET,		/* u32 */
+	REC_STATUS,		/* u64 */
+	REC_MISC,		/* u64 */
+	REC_ADDR,		/* u64 */
+	REC_MCGSTATUS,		/* u64 */
+	REC_TIME,		/* u64 */
+	REC_MCACOD,		/* u16 */
+	REC_MSCOD,		/* u16 */
+	REC_CHANNEL,		/* s32 */
+	REC_DIMM,		/* s32 */
+	REC_FIELD,		/* string, not 0 terminated */
+	REC_UNKNOWN_FIELD,	/* u32 start bit, u64 value */
+	REC_NUMFIELD,		/* u64 value, name string */
+	REC_MCA_TEXT,		/* string, decoded MCACOD */
+	REC_MODEL_TEXT,		/* string, model specific decoding */
+};
+
+extern enum record_format record_format;
+extern char *record_file;
+extern __thread int record_open;
+
+int record_set_format(char *s);
+void record_setup(void);
+void record_begin(struct mce *m, unsigned recordlen);
+void record_field(const char *name);
+void record_unknown_field(unsigned start_bit, u64 v);
+void record_numfield(const char *name, u64 v);
+void record_text_begin(void);
+void record_text_end(enum record_tlv type);
+void record_end(void);
+void record_flush(void);
+void record_startbatch(void);
+char *record_takebatch(size_t *len);
+void record_writebatch(char *buf, size_t len);
+
+#endif
@@ -74,8 +74,10 @@ static struct field memctrl_mc8[] = {
 	{}
 };
 
-void snb_decode_model(int cputype, int bank, u64 status, u64 misc)
+void snb_decode_model(int cputype, struct mce *m)
 {
+	int bank = m->bank;
+	u64 status = m->status;
 	switch (bank) { 
 	case 4:
 		Wprintf("PCU: ");
@@ -368,8 +368,10 @@ static enum banktype sapphire[32] = {
 	[30 ... 31]	= BT_HBMIMC,
 };
 
-void sapphire_decode_model(int cputype, int bank, u64 status, u64 misc)
+void sapphire_decode_model(int cputype, struct mce *m)
 {
+	int bank = m->bank;
+	u64 status = m->status, misc = m->misc;
 	enum banktype banktype;
 	u64 f;
 
@@ -1,2 +1,2 @@
-void sapphire_decode_model(int cputype, int bank, u64 status, u64 misc);
+void sapphire_decode_model(int cputype, struct mce *m);
 void sapphire_memerr_misc(struct mce *m, int *channel, int *dimm);
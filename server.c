@@ -38,6 +38,8 @@
 #include "memutil.h"
 #include "paths.h"
 #include "page.h"
+#include "trigger.h"
+#include "list.h"
 
 #define PAIR(x) x, sizeof(x)-1
 
@@ -47,12 +49,25 @@ struct clientcon {
 	char *outbuf;
 	size_t outcur;
 	size_t outlen;
+	int binary;	/* replies in frames, see server.h */
+	struct pollfd *pfd;
+	/* Events of a subscribed client, in a ring of subscribe_buffer bytes */
+	struct list_head subscriber;
+	char *ring;
+	size_t ring_start;
+	size_t ring_len;
+	unsigned long long dropped;	/* events lost since the last queued */
 };
 
 static char *client_path = SOCKET_PATH;
 static int initial_ping_timeout = 2;
 static int listen_backlog = 10;
 static struct config_cred acc = { .uid = 0, .gid = -1U };
+static size_t subscribe_buffer = 65536;
+static LIST_HEAD(subscribers);
+static int holding;
+static char **held;		/* threshold messages while holding */
+static unsigned num_held;
 
 static void free_outbuf(struct clientcon *cc)
 {
@@ -70,6 +85,11 @@ static void free_inbuf(struct clientcon *cc)
 
 static void free_cc(struct clientcon *cc)
 {
+	if (cc->ring) {
+		list_del(&cc->subscriber);
+		free(cc->ring);
+		cc->ring = NULL;
+	}
 	free(cc->outbuf);
 	cc->outbuf = NULL;
 	free(cc->inbuf);
@@ -83,10 +103,47 @@ static void sendstring(int fd, char *str)
 	(void)send(fd, str, strlen(str), MSG_DONTWAIT|MSG_NOSIGNAL);
 }
 
-static void dispatch_dump(FILE *fh, char *s)
+static void reply_error(FILE *fh, int binary, char *msg)
+{
+	if (binary)
+		put_frame(fh, MCE_FRAME_ERROR, msg, strlen(msg));
+	else
+		fprintf(fh, "%s\n", msg);
+}
+
+static void reply_done(FILE *fh, int binary)
+{
+	if (binary)
+		put_frame(fh, MCE_FRAME_DONE, NULL, 0);
+	else
+		fprintf(fh, "done\n");
+}
+
+static void reply_generation(FILE *fh, int binary)
+{
+	if (binary)
+		put_frame(fh, MCE_FRAME_GENERATION, &error_gen, sizeof(error_gen));
+	else
+		fprintf(fh, "generation %llu\n", error_gen);
+}
+
+/* Parse "since N", returns -1 on error */
+static int parse_since(char **s, unsigned long long *since)
+{
+	char *p = strsep(s, " "), *end;
+
+	if (!p)
+		return -1;
+	*since = strtoull(p, &end, 10);
+	return *p && !*end ? 0 : -1;
+}
+
+static void dispatch_dump(FILE *fh, char *s, int binary)
 {
 	char *p;
 	enum printflags printflags = 0;
+	unsigned long long since = 0;
+	int delta = 0;
 
 	while ((p = strsep(&s, " ")) != NULL) {
 		if (!strcmp(p, "dump"))
@@ -95,33 +152,235 @@ static void dispatch_dump(FILE *fh, char *s)
 			printflags |= DUMP_BIOS;
 		else if (!strcmp(p, "all"))
 			printflags |= DUMP_ALL;
+		else if (!strcmp(p, "since") && parse_since(&s, &since) == 0)
+			delta = 1;
 		else 
-			fprintf(fh, "Unknown dump parameter\n");
+			reply_error(fh, binary, "Unknown dump parameter");
 	}			
 
-	dump_memory_errors(fh, printflags);
-	fprintf(fh, "done\n");
+	if (binary)
+		printflags |= DUMP_BINARY;
+	dump_memory_errors(fh, printflags, since);
+	if (delta || binary)
+		reply_generation(fh, binary);
+	reply_done(fh, binary);
+}
+
+static void dispatch_pages(FILE *fh, char *s, int binary)
+{
+	char *p;
+	unsigned long long since = 0;
+	int delta = 0;
+
+	while ((p = strsep(&s, " ")) != NULL) {
+		if (!strcmp(p, "pages"))
+			;
+		else if (!strcmp(p, "since") && parse_since(&s, &since) == 0)
+			delta = 1;
+		else
+			reply_error(fh, binary, "Unknown pages parameter");
+	}
+
+	dump_page_errors(fh, binary ? DUMP_BINARY : 0, since);
+	if (delta || binary)
+		reply_generation(fh, binary);
+	reply_done(fh, binary);
+}
+
+static void dispatch_triggers(FILE *fh, int binary)
+{
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *f;
+
+	if (!binary) {
+		dump_trigger_stats(fh);
+		fprintf(fh, "done\n");
+		return;
+	}
+	f = open_memstream(&buf, &len);
+	if (!f)
+		Enomem();
+	dump_trigger_stats(f);
+	if (ferror(f) || fclose(f) != 0)
+		Enomem();
+	put_frame(fh, MCE_FRAME_TEXT, buf, len);
+	put_frame(fh, MCE_FRAME_DONE, NULL, 0);
+	free(buf);
+}
+
+/* 
+ * Events are queued in the ring of each subscriber and sent when the socket
+ * is writable. An event that does not fit is dropped and counted, and the
+ * count is queued before the next event that fits. So a slow subscriber
+ * only loses events and never holds up the daemon.
+ */
+static void dispatch_subscribe(struct clientcon *cc, FILE *fh)
+{
+	if (!cc->ring) {
+		cc->ring = xalloc_nonzero(subscribe_buffer);
+		cc->ring_start = cc->ring_len = 0;
+		list_add_tail(&cc->subscriber, &subscribers);
+	}
+	reply_done(fh, cc->binary);
+}
+
+static void ring_put(struct clientcon *cc, const void *data, size_t len)
+{
+	size_t end = (cc->ring_start + cc->ring_len) % subscribe_buffer;
+	size_t n = len < subscribe_buffer - end ? len : subscribe_buffer - end;
+
+	memcpy(cc->ring + end, data, n);
+	memcpy(cc->ring, (char *)data + n, len - n);
+	cc->ring_len += len;
+}
+
+static void publish(char *text, unsigned type, const void *data, unsigned len)
+{
+	struct mce_frame h = { .len = len, .type = type };
+	struct mce_frame dh = { .len = sizeof(uint64_t), .type = MCE_FRAME_DROPPED };
+	struct clientcon *cc;
+	size_t tlen = strlen(text);
+
+	list_for_each_entry (cc, &subscribers, subscriber) {
+		size_t need = cc->binary ? sizeof(h) + len : tlen;
+		char note[40];
+		size_t nlen = 0;
+
+		if (cc->dropped && cc->binary)
+			nlen = sizeof(dh) + sizeof(uint64_t);
+		else if (cc->dropped)
+			nlen = snprintf(note, sizeof(note), "dropped %llu\n",
+					cc->dropped);
+		if (nlen + need > subscribe_buffer - cc->ring_len) {
+			cc->dropped++;
+			continue;
+		}
+		if (cc->dropped && cc->binary) {
+			ring_put(cc, &dh, sizeof(dh));
+			ring_put(cc, &cc->dropped, sizeof(uint64_t));
+		} else if (cc->dropped)
+			ring_put(cc, note, nlen);
+		if (cc->binary) {
+			ring_put(cc, &h, sizeof(h));
+			ring_put(cc, data, len);
+		} else
+			ring_put(cc, text, tlen);
+		cc->dropped = 0;
+		set_pollcb_events(cc->pfd, POLLOUT);
+	}
+}
+
+/* A decoded machine check, before its errors are accounted */
+void server_publish_mce(struct mce *m)
+{
+	struct mce_frame_mce d = {
+		.status = m->status,
+		.addr = m->addr,
+		.misc = m->misc,
+		.mcgstatus = m->mcgstatus,
+		.time = m->time,
+		.cpu = m->extcpu ? m->extcpu : m->cpu,
+		.socketid = m->socketid,
+		.apicid = m->apicid,
+		.bank = m->bank,
+	};
+	char *text;
+
+	if (list_empty(&subscribers))
+		return;
+	xasprintf(&text, "mce cpu %u bank %u socket %u apicid %x status %llx "
+		  "addr %llx misc %llx mcgstatus %llx time %llu\n",
+		  d.cpu, d.bank, d.socketid, d.apicid, m->status, m->addr,
+		  m->misc, m->mcgstatus, m->time);
+	publish(text, MCE_FRAME_MCE, &d, sizeof(d));
+	free(text);
+}
+
+/* An error threshold was crossed */
+void server_publish_threshold(char *msg)
+{
+	char *text;
+
+	if (list_empty(&subscribers))
+		return;
+	if (holding) {
+		held = xrealloc(held, (num_held + 1) * sizeof(char *));
+		held[num_held++] = xstrdup(msg);
+		return;
+	}
+	xasprintf(&text, "threshold %s\n", msg);
+	publish(text, MCE_FRAME_THRESHOLD, msg, strlen(msg));
+	free(text);
 }
 
-static void dispatch_pages(FILE *fh)
+/* Keep threshold events back until the machine check causing them is published */
+void server_hold_events(void)
 {
-	dump_page_errors(fh);
-	fprintf(fh, "done\n");
+	holding = 1;
 }
 
-static void dispatch_commands(char *line, FILE *fh)
+void server_release_events(void)
+{
+	unsigned i;
+
+	holding = 0;
+	for (i = 0; i < num_held; i++) {
+		server_publish_threshold(held[i]);
+		free(held[i]);
+	}
+	free(held);
+	held = NULL;
+	num_held = 0;
+}
+
+/* "hello binary VERSION" switches the connection to framed replies */
+static void dispatch_hello(struct clientcon *cc, FILE *fh, char *s)
+{
+	unsigned version = 0;
+	char *end;
+
+	strsep(&s, " ");
+	if (s && !strncmp(s, "binary ", 7)) {
+		version = strtoul(s + 7, &end, 10);
+		if (s[7] == 0 || *end != 0)
+			version = 0;
+	}
+	if (version != MCE_PROTO_VERSION) {
+		reply_error(fh, cc->binary, "Unsupported protocol");
+		reply_done(fh, cc->binary);
+		return;
+	}
+	cc->binary = 1;
+	put_frame(fh, MCE_FRAME_HELLO, &version, sizeof(uint32_t));
+	put_frame(fh, MCE_FRAME_DONE, NULL, 0);
+}
+
+static void dispatch_commands(struct clientcon *cc, char *line, FILE *fh)
 {
 	char *s;
 	while ((s = strsep(&line, "\n")) != NULL) { 
 		while (isspace(*s))
-			line++;
+			s++;
 		if (!strncmp(s, "dump", 4))
-			dispatch_dump(fh, s);
+			dispatch_dump(fh, s, cc->binary);
 		else if (!strncmp(s, "pages", 5))
-			dispatch_pages(fh);
-		else if (!strcmp(s, "ping"))
+			dispatch_pages(fh, s, cc->binary);
+		else if (!strcmp(s, "triggers"))
+			dispatch_triggers(fh, cc->binary);
+		else if (!strncmp(s, "hello", 5))
+			dispatch_hello(cc, fh, s);
+		else if (!strcmp(s, "subscribe"))
+			dispatch_subscribe(cc, fh);
+		else if (!strcmp(s, "ping") && cc->binary) {
+			put_frame(fh, MCE_FRAME_TEXT, PAIR("pong\n"));
+			put_frame(fh, MCE_FRAME_DONE, NULL, 0);
+		} else if (!strcmp(s, "ping"))
 			fprintf(fh, "pong\n");
-		else if (*s != 0)
+		else if (*s != 0 && cc->binary) {
+			put_frame(fh, MCE_FRAME_ERROR, PAIR("Unknown command"));
+			put_frame(fh, MCE_FRAME_DONE, NULL, 0);
+		} else if (*s != 0)
 			fprintf(fh, "Unknown command\n");
 	}
 }
@@ -136,7 +395,7 @@ static void process_cmd(struct clientcon *cc)
 	if (!fh)
 		Enomem();
 	cc->outcur = 0;
-	dispatch_commands(cc->inbuf, fh);
+	dispatch_commands(cc, cc->inbuf, fh);
 	if (ferror(fh) || fclose(fh) != 0)
 		Enomem();
 }
@@ -222,6 +481,22 @@ static void client_event(struct pollfd *pfd, void *data)
 		}
 		if (cc->outcur == cc->outlen)
 			free_outbuf(cc);
+		else
+			goto out;
+		if (cc->ring_len > 0) {
+			size_t len = subscribe_buffer - cc->ring_start;
+
+			if (len > cc->ring_len)
+				len = cc->ring_len;
+			n = send(pfd->fd, cc->ring + cc->ring_start, len,
+				 MSG_DONTWAIT|MSG_NOSIGNAL);
+			if (n < 0 && errno != EAGAIN && errno != EINTR)
+				goto error;
+			if (n > 0) {
+				cc->ring_start = (cc->ring_start + n) % subscribe_buffer;
+				cc->ring_len -= n;
+			}
+		}
 	}
 	if (events & POLLIN) {
 		n = client_input(pfd->fd, cc);
@@ -230,14 +505,16 @@ static void client_event(struct pollfd *pfd, void *data)
 		process_cmd(cc);
 		free_inbuf(cc);
 	}
-	pfd->events = cc->outbuf ? POLLOUT : POLLIN;
+out:
+	/* Commands are read when no reply or event is partially sent */
+	pfd->events = cc->outbuf || cc->ring_len > 0 ? POLLOUT : POLLIN;
 	return;
 
 error:
 	if (pfd->revents & POLLERR)
 		SYSERRprintf("error while reading from client");
-	close(pfd->fd);
 	unregister_pollcb(pfd);
+	close(pfd->fd);
 	free_cc(cc);
 }
 
@@ -260,7 +537,8 @@ static void client_accept(struct pollfd *pfd, void *data)
 	}
 
 	cc = xalloc(sizeof(struct clientcon));
-	if (register_pollcb(nfd, POLLIN, client_event, cc) < 0) {
+	cc->pfd = add_pollcb(nfd, POLLIN, client_event, cc);
+	if (!cc->pfd) {
 		sendstring(nfd, "mcelog server too busy\n");
 		goto cleanup;
 	}
@@ -285,6 +563,13 @@ static void server_config(void)
 		initial_ping_timeout = v;
 	if (config_number("server", "listen-backlog", "%u", &l) == 0)
 		listen_backlog = l;
+	if (config_number("server", "subscribe-buffer", "%u", &l) == 0) {
+		if (l < 1024)
+			Eprintf("server subscribe-buffer %d too small, using %zu\n",
+				l, subscribe_buffer);
+		else
+			subscribe_buffer = l;
+	}
 }
 
 static sigjmp_buf ping_timeout_ctx;
@@ -1 +1,108 @@
+#ifndef SERVER_H
+#define SERVER_H 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include "leaky-bucket.h"
+
+struct mce;
+
 void server_setup(void);
+void server_publish_mce(struct mce *m);
+void server_publish_threshold(char *msg);
+void server_hold_events(void);
+void server_release_events(void);
+
+/*
+ * Binary replies on the daemon socket. A client switches its connection
+ * with the text command "hello binary 1"; commands stay text lines.
+ * Every reply is then a sequence of frames, each a struct mce_frame
+ * followed by len bytes of payload, and ends with MCE_FRAME_DONE.
+ * All fields are in host byte order.
+ *
+ * After "subscribe" the reply is only the DONE frame, then events follow
+ * without a DONE: MCE and THRESHOLD frames, and a DROPPED frame when
+ * events were lost because the client did not keep up.
+ */
+#define MCE_PROTO_VERSION 1
+
+enum mce_frame_type {
+	MCE_FRAME_DONE = 1,		/* end of the reply */
+	MCE_FRAME_HELLO,		/* uint32_t version */
+	MCE_FRAME_TEXT,			/* output of a command without records */
+	MCE_FRAME_ERROR,		/* text */
+	MCE_FRAME_GENERATION,		/* uint64_t for the next "since" */
+	MCE_FRAME_DIMM,			/* struct mce_frame_dimm */
+	MCE_FRAME_SOCKET,		/* struct mce_frame_dimm */
+	MCE_FRAME_PAGE,			/* struct mce_frame_page */
+	MCE_FRAME_PAGE_REMOVED,		/* uint64_t address */
+	MCE_FRAME_PAGES_RESET,		/* all pages follow, forget the old ones */
+	MCE_FRAME_MCE,			/* struct mce_frame_mce */
+	MCE_FRAME_THRESHOLD,		/* text of the threshold message */
+	MCE_FRAME_DROPPED,		/* uint64_t events lost before this one */
+};
+
+struct mce_frame {
+	uint32_t len;
+	uint16_t type;
+	uint16_t pad;
+};
+
+struct mce_frame_bucket {
+	uint32_t count;
+	uint32_t excess;
+	int64_t tstamp;
+};
+
+/* A DIMM, or with channel and dimm -1 in MCE_FRAME_SOCKET a socket */
+struct mce_frame_dimm {
+	int32_t socketid;
+	int32_t channel;		/* -1: unknown */
+	int32_t dimm;			/* -1: unknown */
+	uint32_t ce_count;
+	uint32_t uc_count;
+	uint32_t pad;
+	struct mce_frame_bucket ce;
+	struct mce_frame_bucket uc;
+};
+
+struct mce_frame_page {
+	uint64_t addr;
+	uint32_t count;
+	uint8_t offlined;		/* 0 online, 1 offline, 2 offline-failed */
+	uint8_t triggered;
+	uint16_t pad;
+	struct mce_frame_bucket bucket;
+};
+
+struct mce_frame_mce {
+	uint64_t status;
+	uint64_t addr;
+	uint64_t misc;
+	uint64_t mcgstatus;
+	uint64_t time;
+	uint32_t cpu;
+	uint32_t socketid;
+	uint32_t apicid;
+	uint32_t bank;
+};
+
+static inline void put_frame(FILE *f, unsigned type, const void *data,
+			     unsigned len)
+{
+	struct mce_frame h = { .len = len, .type = type };
+
+	fwrite(&h, sizeof(h), 1, f);
+	if (len)
+		fwrite(data, len, 1, f);
+}
+
+static inline void frame_bucket(struct mce_frame_bucket *d,
+				const struct leaky_bucket *b)
+{
+	d->count = b->count;
+	d->excess = b->excess;
+	d->tstamp = b->tstamp;
+}
+
+#endif
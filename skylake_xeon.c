@@ -171,8 +171,10 @@ static struct field m2m[] = {
 	{}
 };
 
-void skylake_s_decode_model(int cputype, int bank, u64 status, u64 misc)
+void skylake_s_decode_model(int cputype, struct mce *m)
 {
+	int bank = m->bank;
+	u64 status = m->status;
 	switch (bank) {
 	case 4:
 		Wprintf("PCU: ");
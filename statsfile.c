@@ -0,0 +1,193 @@
+/* Error counter statistics for monitoring agents.
+   The daemon publishes the DIMM and page error counters and the trigger
+   statistics in a shared memory file, protected by a sequence counter,
+   so agents can read them without a request to the daemon. The file is
+   rewritten a short time after counters changed.
+
+   mcelog is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; version
+   2.
+
+   mcelog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should find a copy of v2 of the GNU General Public License somewhere
+   on your Linux system; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA */
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include "mcelog.h"
+#include "leaky-bucket.h"
+#include "eventloop.h"
+#include "statsfile.h"
+
+#define PUBLISH_DELAY 1000	/* ms after the first change */
+#define INITIAL_SIZE 65536
+
+static char *statsfile;
+static int stats_fd = -1;
+static char *map;
+static size_t map_size;
+static size_t used;
+static int publish_timer = -1;
+static int dirty;
+
+#define HDR ((struct stats_header *)map)
+
+int statsfile_modifier(int opt)
+{
+	switch (opt) {
+	case O_STATSFILE:
+		statsfile = optarg;
+		break;
+	default:
+		return 0;
+	}
+	return 1;
+}
+
+void statsfile_usage(void)
+{
+	fprintf(stderr,
+"--stats-file filename Publish the error counters of the daemon in filename\n"
+		);
+}
+
+void stats_bucket(struct stats_bucket *s, const struct leaky_bucket *b)
+{
+	s->count = b->count;
+	s->excess = b->excess;
+	s->tstamp = b->tstamp;
+}
+
+/* Grow the file and the mapping. Readers keep their smaller mapping */
+static int stats_grow(size_t size)
+{
+	char *m;
+
+	if (ftruncate(stats_fd, size) < 0) {
+		SYSERRprintf("Cannot grow stats file `%s'", statsfile);
+		return -1;
+	}
+	m = mremap(map, map_size, size, MREMAP_MAYMOVE);
+	if (m == MAP_FAILED) {
+		SYSERRprintf("Cannot map stats file `%s'", statsfile);
+		return -1;
+	}
+	map = m;
+	map_size = size;
+	return 0;
+}
+
+/* Room for len more bytes, zeroed, or NULL */
+static void *stats_reserve(size_t len)
+{
+	void *p;
+
+	if (used + len > map_size && stats_grow(map_size * 2 > used + len ?
+					map_size * 2 : used + len) < 0)
+		return NULL;
+	p = map + used;
+	memset(p, 0, len);
+	used += len;
+	return p;
+}
+
+struct stats_dimm *stats_add_dimm(void)
+{
+	struct stats_dimm *d = stats_reserve(sizeof(struct stats_dimm));
+
+	if (d)
+		HDR->ndimms++;
+	return d;
+}
+
+/* All DIMMs have to be added before the first reporter */
+struct stats_reporter *stats_add_reporter(void)
+{
+	struct stats_reporter *r;
+
+	if (HDR->nreporters == 0)
+		HDR->reporter_off = used;
+	r = stats_reserve(sizeof(struct stats_reporter));
+	if (r)
+		HDR->nreporters++;
+	return r;
+}
+
+static void publish(void *data)
+{
+	dirty = 0;
+
+	/* Odd seq before any data is written */
+	__atomic_store_n(&HDR->seq, HDR->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	used = sizeof(struct stats_header);
+	HDR->updated = time(NULL);
+	HDR->pid = getpid();
+	HDR->ndimms = 0;
+	HDR->dimm_off = used;
+	HDR->nreporters = 0;
+	HDR->reporter_off = used;
+	page_stats(HDR);
+	memdb_stats();
+	trigger_stats();
+	HDR->size = used;
+
+	__atomic_store_n(&HDR->seq, HDR->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Counters changed, publish them soon */
+void stats_changed(void)
+{
+	if (!map || dirty)
+		return;
+	dirty = 1;
+	arm_timer(publish_timer, PUBLISH_DELAY);
+}
+
+/* Create the file. Needs the counters restored */
+void statsfile_setup(void)
+{
+	if (!statsfile)
+		return;
+	/* Readers of a previous daemon keep the old file */
+	unlink(statsfile);
+	stats_fd = open(statsfile, O_RDWR|O_CREAT|O_EXCL|O_CLOEXEC, 0644);
+	if (stats_fd < 0) {
+		SYSERRprintf("Cannot create stats file `%s'", statsfile);
+		return;
+	}
+	if (ftruncate(stats_fd, INITIAL_SIZE) < 0) {
+		SYSERRprintf("Cannot size stats file `%s'", statsfile);
+		goto err;
+	}
+	map = mmap(NULL, INITIAL_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, stats_fd, 0);
+	if (map == MAP_FAILED) {
+		SYSERRprintf("Cannot map stats file `%s'", statsfile);
+		map = NULL;
+		goto err;
+	}
+	map_size = INITIAL_SIZE;
+	HDR->magic = STATS_MAGIC;
+	HDR->version = STATS_VERSION;
+	publish_timer = register_oneshot_timercb(publish, NULL);
+	publish(NULL);
+	return;
+
+err:
+	close(stats_fd);
+	stats_fd = -1;
+	unlink(statsfile);
+}
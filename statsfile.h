@@ -0,0 +1,89 @@
+#ifndef STATSFILE_H
+#define STATSFILE_H 1
+
+#include <stdint.h>
+
+/*
+ * Layout of the statistics file the daemon publishes with --stats-file.
+ * All fields are in host byte order, the arrays are at the given offsets
+ * from the start of the file.
+ *
+ * seq is odd while the daemon updates the file. A reader copies the
+ * first size bytes and retries when seq was odd or has changed after
+ * the copy. The file only grows; when size is larger than the mapping
+ * of a reader it has to map the file again.
+ */
+#define STATS_MAGIC 0x5345434d	/* "MCES" */
+#define STATS_VERSION 1
+
+struct stats_bucket {
+	uint32_t count;
+	uint32_t excess;
+	int64_t tstamp;
+};
+
+struct stats_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t seq;
+	uint32_t size;
+	int64_t updated;
+	int32_t pid;
+	uint32_t ndimms;
+	uint32_t dimm_off;
+	uint32_t nreporters;
+	uint32_t reporter_off;
+	uint32_t page_counters;		/* in use */
+	uint32_t page_counters_max;
+	uint32_t replacements;		/* of page counters */
+	struct stats_bucket replacement_bucket;
+};
+
+/* channel and dimm are -1 when unknown, both -1 is the socket total */
+struct stats_dimm {
+	int32_t socketid;
+	int32_t channel;
+	int32_t dimm;
+	uint32_t ce_count;
+	uint32_t uc_count;
+	uint32_t pad;
+	struct stats_bucket ce;
+	struct stats_bucket uc;
+	char location[32];		/* DMI bank locator */
+	char name[32];			/* DMI device locator */
+};
+
+struct stats_reporter {
+	char name[32];
+	uint64_t started;
+	uint64_t queued;
+	uint64_t dropped;
+	uint64_t failed;
+	uint64_t coalesced;
+	uint64_t sent;
+	uint32_t pending;
+	uint32_t max_pending;
+};
+
+enum statsfile_options {
+	O_STATSFILE = O_STATS,
+};
+
+#define STATSFILE_OPTIONS \
+	{ "stats-file", 1, NULL, O_STATSFILE },
+
+struct leaky_bucket;
+
+int statsfile_modifier(int opt);
+void statsfile_usage(void);
+void statsfile_setup(void);
+void stats_changed(void);
+void stats_bucket(struct stats_bucket *s, const struct leaky_bucket *b);
+struct stats_dimm *stats_add_dimm(void);
+struct stats_reporter *stats_add_reporter(void);
+
+void memdb_stats(void);
+void page_stats(struct stats_header *h);
+void trigger_stats(void);
+
+#endif
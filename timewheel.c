@@ -0,0 +1,162 @@
+/* Hierarchical timing wheel for expiring leaky bucket state.
+   Level 0 has a slot per second, every higher level slot covers a whole
+   turn of the level below. Timers are filed into the level their distance
+   falls into and cascade down to lower levels as the wheel turns, so a
+   timer is moved at most once per level.
+
+   mcelog is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation; version
+   2.
+
+   mcelog is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should find a copy of v2 of the GNU General Public License somewhere
+   on your Linux system; if not, write to the Free Software Foundation,
+   Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA */
+#define _GNU_SOURCE 1
+#include <stdlib.h>
+#include "mcelog.h"
+#include "eventloop.h"
+#include "leaky-bucket.h"
+#include "timewheel.h"
+
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4		/* 2^24 seconds, about 194 days */
+#define WHEEL_RANGE (1L << (WHEEL_LEVELS * WHEEL_BITS))
+#define WHEEL_TICK 60		/* s between turns from the event loop */
+
+static struct list_head wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static unsigned pending[WHEEL_LEVELS];
+static time_t wheel_now;	/* next second to expire */
+static int wheel_init;
+
+static void init_wheel(void)
+{
+	int i, k;
+
+	for (i = 0; i < WHEEL_LEVELS; i++)
+		for (k = 0; k < WHEEL_SIZE; k++)
+			INIT_LIST_HEAD(&wheel[i][k]);
+	wheel_now = bucket_time();
+	wheel_init = 1;
+}
+
+static void file_timer(struct wheel_timer *t)
+{
+	time_t expires = t->expires;
+	long delta;
+	int level;
+
+	if (expires < wheel_now)
+		expires = wheel_now;
+	delta = expires - wheel_now;
+	if (delta >= WHEEL_RANGE) 
+		expires = wheel_now + WHEEL_RANGE - 1;	/* refiled on cascade */
+	for (level = 0; level < WHEEL_LEVELS - 1; level++)
+		if (delta < 1L << ((level + 1) * WHEEL_BITS))
+			break;
+	list_add_tail(&t->nd, 
+		&wheel[level][(expires >> (level * WHEEL_BITS)) & WHEEL_MASK]);
+	pending[level]++;
+	t->level = level;
+}
+
+void wheel_add(struct wheel_timer *t, time_t expires)
+{
+	if (!wheel_init)
+		init_wheel();
+	if (wheel_pending(t))
+		wheel_del(t);
+	t->expires = expires;
+	file_timer(t);
+}
+
+void wheel_del(struct wheel_timer *t)
+{
+	if (!wheel_pending(t))
+		return;
+	pending[t->level]--;
+	list_del(&t->nd);
+	t->nd.next = NULL;
+}
+
+/* Refile the timers of the higher level slots the wheel reached */
+static void cascade(void)
+{
+	struct list_head list;
+	struct wheel_timer *t;
+	int level;
+
+	for (level = 1; level < WHEEL_LEVELS; level++) {
+		unsigned idx = (wheel_now >> (level * WHEEL_BITS)) & WHEEL_MASK;
+		struct list_head *slot = &wheel[level][idx];
+
+		INIT_LIST_HEAD(&list);
+		while (!list_empty(slot)) {
+			t = list_entry(slot->next, struct wheel_timer, nd);
+			list_del(&t->nd);
+			pending[level]--;
+			list_add_tail(&t->nd, &list);
+		}
+		while (!list_empty(&list)) {
+			t = list_entry(list.next, struct wheel_timer, nd);
+			list_del(&t->nd);
+			file_timer(t);
+		}
+		if (idx != 0)
+			break;
+	}
+}
+
+/* Run all timers expiring up to now */
+void wheel_advance(time_t now)
+{
+	struct list_head list;
+	struct wheel_timer *t;
+
+	if (!wheel_init)
+		init_wheel();
+	while (wheel_now <= now) {
+		struct list_head *slot = &wheel[0][wheel_now & WHEEL_MASK];
+
+		if ((wheel_now & WHEEL_MASK) == 0)
+			cascade();
+		INIT_LIST_HEAD(&list);
+		while (!list_empty(slot)) {
+			t = list_entry(slot->next, struct wheel_timer, nd);
+			list_del(&t->nd);
+			pending[0]--;
+			list_add_tail(&t->nd, &list);
+		}
+		/* Timers added by the callbacks go to the next second or later */
+		wheel_now++;
+		while (!list_empty(&list)) {
+			t = list_entry(list.next, struct wheel_timer, nd);
+			list_del(&t->nd);
+			t->nd.next = NULL;
+			t->fn(t, now);
+		}
+		/* Nothing to do until the next cascade */
+		if (pending[0] == 0 && (wheel_now & WHEEL_MASK) != 0) {
+			time_t next = (wheel_now | WHEEL_MASK) + 1;
+
+			wheel_now = next <= now ? next : now + 1;
+		}
+	}
+}
+
+static void wheel_tick(void *data)
+{
+	wheel_advance(bucket_time());
+}
+
+void wheel_setup(void)
+{
+	register_timercb(WHEEL_TICK * 1000, wheel_tick, NULL);
+}
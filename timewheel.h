@@ -0,0 +1,28 @@
+#ifndef TIMEWHEEL_H
+#define TIMEWHEEL_H 1
+
+#include <time.h>
+#include "list.h"
+
+/*
+ * Hierarchical timing wheel with a resolution of a second. Adding,
+ * removing and expiring a timer is O(1). Zeroed memory is an inactive timer.
+ */
+struct wheel_timer {
+	struct list_head nd;
+	time_t expires;
+	unsigned level;
+	void (*fn)(struct wheel_timer *t, time_t now);
+};
+
+void wheel_add(struct wheel_timer *t, time_t expires);
+void wheel_del(struct wheel_timer *t);
+void wheel_advance(time_t now);
+void wheel_setup(void);
+
+static inline int wheel_pending(struct wheel_timer *t)
+{
+	return t->nd.next != NULL;
+}
+
+#endif
@@ -17,53 +17,690 @@
    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA */
 #define _GNU_SOURCE 1
 #include <stdio.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <string.h>
 #include <sys/wait.h>
+#include <spawn.h>
+#include <errno.h>
+#include <time.h>
+#include <stdint.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
 #include "trigger.h"
 #include "eventloop.h"
 #include "list.h"
 #include "mcelog.h"
 #include "memutil.h"
 #include "config.h"
+#include "statsfile.h"
+
+/* Trigger statistics per reporter, e.g. "page" or "memdb" */
+struct reporter {
+	struct list_head nd;
+	char *name;
+	unsigned long started;
+	unsigned long queued;
+	unsigned long dropped;
+	unsigned long failed;
+	unsigned long coalesced;
+	unsigned long sent;	/* to the worker */
+	unsigned pending;	/* currently waiting in the queue */
+	unsigned max_pending;
+};
 
 struct child {
 	struct list_head nd;
 	pid_t child;
 	const char *name;
+	struct reporter *rep;
+};
+
+/* A trigger waiting for a free child slot */
+struct pending {
+	struct list_head nd;
+	char *trigger;
+	char **argv;
+	char **env;
+	int infd;
+	struct reporter *rep;
+};
+
+/* Events for one trigger and reporter collected during the coalescing window */
+struct batch {
+	struct list_head nd;
+	char *trigger;
+	struct reporter *rep;
+	char **argv;
+	char **env;		/* of the latest event */
+	FILE *manifest;		/* environment of every event */
+	char *manifest_buf;
+	size_t manifest_len;
+	unsigned events;
+	unsigned long long deadline;
 };
 
 static LIST_HEAD(childlist);
+static LIST_HEAD(pendinglist);
+static LIST_HEAD(reporters);
+static LIST_HEAD(batches);
 static int num_children;
+static int num_pending;
 static int children_max = 4;
+static int queue_max = 64;
 static char *trigger_dir;
+static unsigned coalesce_window;	/* ms */
+static int coalesce_timer = -1;
 
 static void finish_child(pid_t child, int status);
 
-pid_t mcelog_fork(const char *name)
+static void add_child(pid_t child, const char *name, struct reporter *rep)
 {
-	pid_t child;
 	struct child *c;
 
-	child = fork();
-	if (child <= 0)
-		return child;
-
 	num_children++;
 	c = xalloc(sizeof(struct child));
 	c->name = name;
 	c->child = child;
+	c->rep = rep;
 	list_add_tail(&c->nd, &childlist);
+}
+
+pid_t mcelog_fork(const char *name)
+{
+	pid_t child;
+
+	child = fork();
+	if (child <= 0)
+		return child;
+
+	add_child(child, name, NULL);
 	return child;
 }
 
+static struct reporter *find_reporter(const char *name)
+{
+	struct reporter *r;
+
+	list_for_each_entry (r, &reporters, nd) {
+		if (!strcmp(r->name, name))
+			return r;
+	}
+	r = xalloc(sizeof(struct reporter));
+	r->name = xstrdup((char *)name);
+	list_add_tail(&r->nd, &reporters);
+	return r;
+}
+
+static char **copy_strv(char **v)
+{
+	char **n;
+	int i, len;
+
+	for (len = 0; v[len]; len++)
+		;
+	n = xalloc((len + 1) * sizeof(char *));
+	for (i = 0; i < len; i++)
+		n[i] = xstrdup(v[i]);
+	return n;
+}
+
+static void free_strv(char **v)
+{
+	int i;
+
+	for (i = 0; v[i]; i++)
+		free(v[i]);
+	free(v);
+}
+
+/*
+ * The environment of a trigger is formatted into one arena of NUL
+ * separated strings that is reused for every event, so once it has grown
+ * to size running a trigger does not allocate for its environment.
+ * The array from trigger_env_finish() is valid until the next
+ * trigger_env_start().
+ */
+static char *env_buf;
+static size_t env_len, env_size;
+static char **env_vec;
+static unsigned env_vec_size;
+
+static void env_reserve(size_t len)
+{
+	if (env_len + len <= env_size)
+		return;
+	env_size = env_size * 2 > env_len + len ? env_size * 2 : env_len + len;
+	env_buf = xrealloc(env_buf, env_size);
+}
+
+void trigger_env_start(void)
+{
+	env_len = 0;
+}
+
+/* Add a NAME=value string */
+void trigger_env_add(const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(env_buf + env_len, env_size - env_len, fmt, ap);
+	va_end(ap);
+	if (n < 0)
+		return;
+	if (env_len + n >= env_size) {
+		env_reserve(n + 1);
+		va_start(ap, fmt);
+		vsnprintf(env_buf + env_len, env_size - env_len, fmt, ap);
+		va_end(ap);
+	}
+	env_len += n + 1;
+}
+
+/* Add strings saved with trigger_env_save() */
+void trigger_env_add_saved(const char *block, size_t len)
+{
+	env_reserve(len);
+	memcpy(env_buf + env_len, block, len);
+	env_len += len;
+}
+
+/* Return a copy of the strings added since trigger_env_start() */
+char *trigger_env_save(size_t *len)
+{
+	char *block = xalloc_nonzero(env_len ? env_len : 1);
+
+	memcpy(block, env_buf, env_len);
+	*len = env_len;
+	return block;
+}
+
+char **trigger_env_finish(void)
+{
+	unsigned n = 0;
+	size_t i;
+
+	for (i = 0;; i += strlen(env_buf + i) + 1) {
+		if (n == env_vec_size) {
+			env_vec_size = env_vec_size ? env_vec_size * 2 : 32;
+			env_vec = xrealloc(env_vec, env_vec_size * sizeof(char *));
+		}
+		if (i >= env_len)
+			break;
+		env_vec[n++] = env_buf + i;
+	}
+	env_vec[n] = NULL;
+	return env_vec;
+}
+
+/* 
+ * Start a process without duplicating the daemon's address space:
+ * posix_spawn uses vfork semantics and only the exec copies anything.
+ * infd, if any, becomes the process' stdin and is closed.
+ */
+static int spawn(char *path, char *argv[], char **env, int infd, pid_t *child)
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	sigset_t mask;
+	int err;
+
+	posix_spawnattr_init(&attr);
+	child_sigmask(&mask);
+	posix_spawnattr_setsigmask(&attr, &mask);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+	posix_spawn_file_actions_init(&actions);
+	if (trigger_dir)
+		posix_spawn_file_actions_addchdir_np(&actions, trigger_dir);
+	if (infd >= 0)
+		posix_spawn_file_actions_adddup2(&actions, infd, 0);
+
+	err = posix_spawn(child, path, &actions, &attr, argv, env);
+
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+	if (infd >= 0)
+		close(infd);
+	return err;
+}
+
+static void spawn_trigger(char *trigger, char *argv[], char **env, int infd,
+			  struct reporter *rep)
+{
+	pid_t child;
+	int err;
+
+	err = spawn(trigger, argv, env, infd, &child);
+	if (err) {
+		errno = err;
+		SYSERRprintf("Cannot run trigger `%s'", trigger);
+		rep->failed++;
+		return;
+	}
+	add_child(child, trigger, rep);
+	rep->started++;
+}
+
+static int child_slot_free(void)
+{
+	return children_max <= 0 || num_children < children_max;
+}
+
+/* Start queued triggers in order while there are free child slots */
+static void run_pending(void)
+{
+	struct pending *p;
+
+	while (num_pending > 0 && child_slot_free()) {
+		p = list_entry(pendinglist.next, struct pending, nd);
+		list_del(&p->nd);
+		num_pending--;
+		p->rep->pending--;
+		Lprintf("Running queued trigger `%s' (reporter: %s)\n", 
+			p->trigger, p->rep->name);
+		spawn_trigger(p->trigger, p->argv, p->env, p->infd, p->rep);
+		free_strv(p->argv);
+		free_strv(p->env);
+		free(p);
+	}
+}
+
+/* Run the trigger now or queue it until a child slot is free */
+static void start_trigger(char *trigger, char *argv[], char **env, int infd,
+			  struct reporter *rep)
+{
+	struct pending *p;
+
+	if (child_slot_free()) {
+		spawn_trigger(trigger, argv, env, infd, rep);
+		return;
+	}
+
+	if (num_pending >= queue_max) {
+		Eprintf("Too many trigger children running and queued already, dropping `%s'\n",
+			trigger);
+		rep->dropped++;
+		if (infd >= 0)
+			close(infd);
+		return;
+	}
+	p = xalloc(sizeof(struct pending));
+	p->trigger = trigger;
+	p->argv = copy_strv(argv);
+	p->env = copy_strv(env);
+	p->infd = infd;
+	p->rep = rep;
+	list_add_tail(&p->nd, &pendinglist);
+	num_pending++;
+	rep->queued++;
+	if (++rep->pending > rep->max_pending)
+		rep->max_pending = rep->pending;
+}
+
+static unsigned long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+/* 
+ * Run one trigger for all events of the batch. The environment is the one of
+ * the latest event plus EVENTS, stdin has the environment of every event
+ * as NAME=value lines with an empty line after each event.
+ */
+static void flush_batch(struct batch *b)
+{
+	char **env;
+	char *events;
+	int i, fd, len;
+
+	list_del(&b->nd);
+	fclose(b->manifest);
+
+	fd = memfd_create("mcelog-trigger", MFD_CLOEXEC);
+	if (fd < 0)
+		SYSERRprintf("Cannot create trigger event list");
+	else if (write(fd, b->manifest_buf, b->manifest_len) != (ssize_t)b->manifest_len ||
+		 lseek(fd, 0, SEEK_SET) < 0) {
+		SYSERRprintf("Cannot write trigger event list");
+		close(fd);
+		fd = -1;
+	}
+
+	for (len = 0; b->env[len]; len++)
+		;
+	env = xalloc((len + 2) * sizeof(char *));
+	for (i = 0; i < len; i++)
+		env[i] = b->env[i];
+	xasprintf(&events, "EVENTS=%u", b->events);
+	env[len] = events;
+
+	Lprintf("Running trigger `%s' for %u events (reporter: %s)\n", 
+		b->trigger, b->events, b->rep->name);
+	start_trigger(b->trigger, b->argv, env, fd, b->rep);
+
+	free(events);
+	free(env);
+	free_strv(b->argv);
+	free_strv(b->env);
+	free(b->manifest_buf);
+	free(b);
+}
+
+static void coalesce_timeout(void *data)
+{
+	unsigned long long now = now_ms();
+	struct batch *b;
+
+	while (!list_empty(&batches)) {
+		b = list_entry(batches.next, struct batch, nd);
+		if (b->deadline > now) {
+			arm_timer(coalesce_timer, b->deadline - now);
+			break;
+		}
+		flush_batch(b);
+	}
+}
+
+/* Collect the event into the batch of its trigger and reporter */
+static void coalesce_trigger(char *trigger, char *argv[], char **env,
+			     struct reporter *rep)
+{
+	struct batch *b;
+	int i;
+
+	list_for_each_entry (b, &batches, nd) {
+		if (b->rep == rep && !strcmp(b->trigger, trigger))
+			goto found;
+	}
+	b = xalloc(sizeof(struct batch));
+	b->trigger = trigger;
+	b->rep = rep;
+	b->manifest = open_memstream(&b->manifest_buf, &b->manifest_len);
+	if (!b->manifest) {
+		SYSERRprintf("Cannot collect trigger events");
+		free(b);
+		start_trigger(trigger, argv, env, -1, rep);
+		return;
+	}
+	b->deadline = now_ms() + coalesce_window;
+	if (list_empty(&batches))
+		arm_timer(coalesce_timer, coalesce_window);
+	list_add_tail(&b->nd, &batches);
+	goto add;
+
+found:
+	free_strv(b->argv);
+	free_strv(b->env);
+	rep->coalesced++;
+add:
+	b->argv = copy_strv(argv);
+	b->env = copy_strv(env);
+	for (i = 0; env[i]; i++)
+		fprintf(b->manifest, "%s\n", env[i]);
+	fputc('\n', b->manifest);
+	b->events++;
+}
+
+/*
+ * The optional trigger worker is a long running process that gets the
+ * trigger events as records on stdin instead of a process per event.
+ * A record is the length of the rest of the record as a 32bit number in
+ * host byte order, followed by NUL terminated NAME=value strings: TRIGGER
+ * and REPORTER and then the environment a trigger would get.
+ */
+#define WORKER_BUF_MAX (256*1024)
+#define WORKER_RESTART_DELAY 1	/* s */
+
+static char *worker_path;
+static pid_t worker_pid;
+static int worker_fd = -1;
+static struct pollfd *worker_pfd;
+static char *worker_buf;	/* records not sent completely yet */
+static size_t worker_len;
+static size_t worker_off;	/* bytes of worker_buf already sent */
+
+/* A record in worker_buf, to run its trigger here when the worker is gone */
+struct worker_rec {
+	char *trigger;
+	struct reporter *rep;
+	size_t end;		/* of the record in worker_buf */
+};
+
+static struct worker_rec *worker_recs;
+static unsigned num_worker_recs;
+static time_t worker_started;
+static unsigned long worker_restarts;
+static int worker_stopping;
+
+/* Run the trigger of a record the worker did not get completely */
+static void worker_rerun(struct worker_rec *r, size_t start)
+{
+	char *p = worker_buf + start + sizeof(uint32_t);
+	char *argv[] = { r->trigger, NULL };
+	char **env;
+	int i, n = 0;
+
+	/* Skip TRIGGER and REPORTER, the rest is the environment */
+	for (i = 0; p + i < worker_buf + r->end; i += strlen(p + i) + 1)
+		n++;
+	env = xalloc((n + 1) * sizeof(char *));
+	for (i = 0, n = 0; p + i < worker_buf + r->end; i += strlen(p + i) + 1)
+		if (n++ >= 2)
+			env[n - 3] = p + i;
+	r->rep->sent--;
+	Lprintf("Running trigger `%s' the worker did not get (reporter: %s)\n",
+		r->trigger, r->rep->name);
+	start_trigger(r->trigger, argv, env, -1, r->rep);
+	free(env);
+}
+
+static void close_worker(void)
+{
+	unsigned i;
+
+	if (worker_fd < 0)
+		return;
+	unregister_pollcb(worker_pfd);
+	close(worker_fd);
+	worker_fd = -1;
+	worker_pfd = NULL;
+	if (num_worker_recs > 0)
+		Eprintf("Trigger worker did not get %u events\n", num_worker_recs);
+	for (i = 0; i < num_worker_recs; i++)
+		worker_rerun(&worker_recs[i], i ? worker_recs[i - 1].end : 0);
+	free(worker_recs);
+	worker_recs = NULL;
+	num_worker_recs = 0;
+	free(worker_buf);
+	worker_buf = NULL;
+	worker_len = worker_off = 0;
+}
+
+/* Forget the records sent completely */
+static void worker_trim(void)
+{
+	unsigned i, k = 0;
+	size_t drop;
+
+	while (k < num_worker_recs && worker_recs[k].end <= worker_off)
+		k++;
+	if (k == 0)
+		return;
+	drop = worker_recs[k - 1].end;
+	memmove(worker_buf, worker_buf + drop, worker_len - drop);
+	worker_len -= drop;
+	worker_off -= drop;
+	memmove(worker_recs, worker_recs + k, (num_worker_recs - k) * sizeof(struct worker_rec));
+	num_worker_recs -= k;
+	for (i = 0; i < num_worker_recs; i++)
+		worker_recs[i].end -= drop;
+}
+
+static void worker_send_buffered(int flags)
+{
+	ssize_t n;
+
+	while (worker_off < worker_len) {
+		n = send(worker_fd, worker_buf + worker_off, worker_len - worker_off,
+			 MSG_NOSIGNAL|flags);
+		if (n <= 0) {
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n == 0 || errno != EAGAIN) {
+				SYSERRprintf("Cannot send to trigger worker");
+				close_worker();
+			}
+			return;
+		}
+		worker_off += n;
+		worker_trim();
+	}
+}
+
+static void worker_event(struct pollfd *pfd, void *data)
+{
+	char buf[256];
+
+	if (pfd->revents & POLLIN) {
+		/* The worker has no business writing, but don't let it block */
+		if (read(worker_fd, buf, sizeof(buf)) <= 0) {
+			close_worker();
+			return;
+		}
+	}
+	if (pfd->revents & (POLLHUP|POLLERR)) {
+		close_worker();
+		return;
+	}
+	worker_send_buffered(MSG_DONTWAIT);
+	if (worker_fd >= 0)
+		pfd->events = worker_len > 0 ? POLLIN|POLLOUT : POLLIN;
+}
+
+static int start_worker(void)
+{
+	char *argv[] = { worker_path, NULL };
+	int sv[2];
+	int err;
+
+	worker_started = time(NULL);
+	if (socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, sv) < 0) {
+		SYSERRprintf("Cannot create trigger worker socket");
+		return -1;
+	}
+	err = spawn(worker_path, argv, environ, sv[1], &worker_pid);
+	if (err) {
+		errno = err;
+		SYSERRprintf("Cannot run trigger worker `%s'", worker_path);
+		worker_pid = 0;
+		close(sv[0]);
+		return -1;
+	}
+	worker_fd = sv[0];
+	worker_pfd = add_pollcb(worker_fd, POLLIN, worker_event, NULL);
+	if (!worker_pfd) {
+		close(worker_fd);
+		worker_fd = -1;
+		return -1;
+	}
+	Lprintf("Started trigger worker `%s'\n", worker_path);
+	return 0;
+}
+
+static void finish_worker(int status)
+{
+	if (WIFEXITED(status))
+		Eprintf("Trigger worker `%s' exited with status %d\n",
+			worker_path, WEXITSTATUS(status));
+	else if (WIFSIGNALED(status))
+		Eprintf("Trigger worker `%s' died with signal %s\n",
+			worker_path, strsignal(WTERMSIG(status)));
+	close_worker();
+	worker_pid = 0;
+	/* Restart right away unless it keeps dying, then on the next event */
+	if (!worker_stopping && time(NULL) - worker_started >= WORKER_RESTART_DELAY) {
+		worker_restarts++;
+		start_worker();
+	}
+}
+
+static void worker_append(const char *s)
+{
+	size_t len = strlen(s) + 1;
+
+	memcpy(worker_buf + worker_len, s, len);
+	worker_len += len;
+}
+
+/* Hand the event to the worker. Returns -1 when the trigger has to run itself */
+static int send_worker(char *trigger, char **env, struct reporter *rep)
+{
+	size_t len, start;
+	uint32_t reclen;
+	char *s;
+	int i;
+
+	if (worker_fd < 0) {
+		if (worker_pid > 0 || worker_stopping ||
+		    time(NULL) - worker_started < WORKER_RESTART_DELAY)
+			return -1;
+		if (worker_started)
+			worker_restarts++;
+		if (start_worker() < 0)
+			return -1;
+	}
+
+	len = sizeof("TRIGGER=") + strlen(trigger) + 
+		sizeof("REPORTER=") + strlen(rep->name);
+	for (i = 0; env[i]; i++)
+		len += strlen(env[i]) + 1;
+	if (worker_len + sizeof(reclen) + len > WORKER_BUF_MAX) {
+		Eprintf("Trigger worker is not keeping up\n");
+		return -1;
+	}
+
+	start = worker_len;
+	worker_buf = xrealloc(worker_buf, worker_len + sizeof(reclen) + len);
+	reclen = len;
+	memcpy(worker_buf + worker_len, &reclen, sizeof(reclen));
+	worker_len += sizeof(reclen);
+	xasprintf(&s, "TRIGGER=%s", trigger);
+	worker_append(s);
+	free(s);
+	xasprintf(&s, "REPORTER=%s", rep->name);
+	worker_append(s);
+	free(s);
+	for (i = 0; env[i]; i++)
+		worker_append(env[i]);
+	assert(worker_len == start + sizeof(reclen) + len);
+	worker_recs = xrealloc(worker_recs, (num_worker_recs + 1) * sizeof(struct worker_rec));
+	worker_recs[num_worker_recs].trigger = trigger;
+	worker_recs[num_worker_recs].rep = rep;
+	worker_recs[num_worker_recs].end = worker_len;
+	num_worker_recs++;
+	rep->sent++;
+
+	/* When sending fails the event runs its trigger from close_worker */
+	worker_send_buffered(MSG_DONTWAIT);
+	if (worker_fd >= 0 && worker_len > 0)
+		set_pollcb_events(worker_pfd, POLLIN|POLLOUT);
+	return 0;
+}
+
 // note: trigger must be allocated, e.g. from config
 void run_trigger(char *trigger, char *argv[], char **env, bool sync, const char* reporter)
 {
-	pid_t child;
+	struct reporter *rep = find_reporter(reporter);
 
 	char *fallback_argv[] = {
 		trigger,
@@ -72,25 +709,18 @@ void run_trigger(char *trigger, char *argv[], char **env, bool sync, const char*
 
 	if (!argv) 
 		argv = fallback_argv;
+	stats_changed();
 
-	Lprintf("Running trigger `%s' (reporter: %s)\n", trigger, reporter);
-	if (children_max > 0 && num_children >= children_max) { 
-		Eprintf("Too many trigger children running already\n");
+	/* Triggers around page offlining must run for every event */
+	if (worker_path && !sync && send_worker(trigger, env, rep) == 0)
 		return;
-	}
-
-	child = mcelog_fork(trigger);
-	if (child < 0) { 
-		SYSERRprintf("Cannot create process for trigger");
+	if (coalesce_window > 0 && coalesce_timer >= 0 && !sync) {
+		coalesce_trigger(trigger, argv, env, rep);
 		return;
 	}
-	if (child == 0) { 
-		if (trigger_dir && chdir(trigger_dir) == -1)
-			SYSERRprintf("Cannot chdir(%s) for trigger", trigger_dir);
-		else
-			execve(trigger, argv, env);
-		_exit(127);	
-	}
+
+	Lprintf("Running trigger `%s' (reporter: %s)\n", trigger, reporter);
+	start_trigger(trigger, argv, env, -1, rep);
 }
 
 /* Clean up child on SIGCHLD */
@@ -98,54 +728,57 @@ static void finish_child(pid_t child, int status)
 {
 	struct child *c, *tmpc;
 
+	stats_changed();
+
+	if (child == worker_pid) {
+		finish_worker(status);
+		return;
+	}
 	list_for_each_entry_safe (c, tmpc, &childlist, nd) {
 		if (c->child == child) { 
 			if (WIFEXITED(status) && WEXITSTATUS(status)) { 
 				Eprintf("Trigger `%s' exited with status %d\n",
 					c->name, WEXITSTATUS(status));
+				if (c->rep)
+					c->rep->failed++;
 			} else if (WIFSIGNALED(status)) { 
 				Eprintf("Trigger `%s' died with signal %s\n",
 					c->name, strsignal(WTERMSIG(status)));
+				if (c->rep)
+					c->rep->failed++;
 			}
 			list_del(&c->nd);
 			free(c);
 			c = NULL;
 			num_children--;
+			run_pending();
 			return;
 		}
 	}
 	abort();
 }
 
-/* Runs only directly after ppoll */
-static void child_handler(int sig, siginfo_t *si, void *ctx)
+/* Called from the event loop. SIGCHLD coalesces, so collect all children */
+static void child_handler(int sig)
 {
 	int status;
 	pid_t pid;
 
-	if (waitpid(si->si_pid, &status, WNOHANG) < 0) {
-		SYSERRprintf("Cannot collect child %d", si->si_pid);
-		return;
-	}
-	finish_child(si->si_pid, status);
-
-	/* Check other child(ren)'s status to avoid zombie process */
-	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
 		finish_child(pid, status);
-	}
 }
  
 void trigger_setup(void)
 {
 	char *s;
-	struct sigaction sa = {
-		.sa_sigaction = child_handler,
-		.sa_flags = SA_SIGINFO|SA_NOCLDSTOP|SA_RESTART,
-	};
-	sigaction(SIGCHLD, &sa, NULL);
-	event_signal(SIGCHLD);
+
+	register_signalcb(SIGCHLD, child_handler);
 
 	config_number("trigger", "children-max", "%d", &children_max);
+	config_number("trigger", "queue-max", "%d", &queue_max);
+	config_number("trigger", "coalesce-window", "%u", &coalesce_window);
+	if (coalesce_window > 0)
+		coalesce_timer = register_oneshot_timercb(coalesce_timeout, NULL);
 
 	s = config_string("trigger", "directory");
 	if (s) { 
@@ -153,6 +786,13 @@ void trigger_setup(void)
 			SYSERRprintf("Cannot access trigger directory `%s'", s);
 		trigger_dir = s;
 	}
+
+	s = config_string("trigger", "worker");
+	if (s) {
+		if (trigger_check(s) < 0)
+			SYSERRprintf("Cannot access trigger worker `%s'", s);
+		worker_path = s;
+	}
 }
 
 void trigger_wait(void)
@@ -160,6 +800,16 @@ void trigger_wait(void)
 	int status;
 	int pid;
 	
+	while (!list_empty(&batches))
+		flush_batch(list_entry(batches.next, struct batch, nd));
+
+	/* Let the worker finish the events it has and see the end of input */
+	worker_stopping = 1;
+	if (worker_fd >= 0) {
+		fcntl(worker_fd, F_SETFL, fcntl(worker_fd, F_GETFL) & ~O_NONBLOCK);
+		worker_send_buffered(0);
+		close_worker();
+	}
 	while ((pid = waitpid((pid_t)-1, &status, 0)) > 0) 
 		finish_child(pid, status);
 }
@@ -183,3 +833,42 @@ int trigger_check(char *s)
 
 	return rc;
 }
+
+/* Publish the statistics per reporter */
+void trigger_stats(void)
+{
+	struct reporter *r;
+
+	list_for_each_entry (r, &reporters, nd) {
+		struct stats_reporter *s = stats_add_reporter();
+
+		if (!s)
+			return;
+		snprintf(s->name, sizeof(s->name), "%s", r->name);
+		s->started = r->started;
+		s->queued = r->queued;
+		s->dropped = r->dropped;
+		s->failed = r->failed;
+		s->coalesced = r->coalesced;
+		s->sent = r->sent;
+		s->pending = r->pending;
+		s->max_pending = r->max_pending;
+	}
+}
+
+void dump_trigger_stats(FILE *f)
+{
+	struct reporter *r;
+
+	fprintf(f, "running %d max %d queued %d max %d\n", 
+		num_children, children_max, num_pending, queue_max);
+	if (worker_path)
+		fprintf(f, "worker %s pid %d restarts %lu unsent %zu\n",
+			worker_path, (int)worker_pid, worker_restarts,
+			worker_len - worker_off);
+	list_for_each_entry (r, &reporters, nd) 
+		fprintf(f, "%s: started %lu queued %lu dropped %lu failed %lu "
+			"pending %u max-pending %u coalesced %lu sent %lu\n", 
+			r->name, r->started, r->queued, r->dropped, r->failed,
+			r->pending, r->max_pending, r->coalesced, r->sent);
+}
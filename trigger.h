@@ -2,10 +2,18 @@
 #define __TRIGGER_H__
 
 #include <stdbool.h>
+#include <stdio.h>
+#include <sys/types.h>
 void run_trigger(char *trigger, char *argv[], char **env, bool sync, const char* reporter);
 void trigger_setup(void);
 void trigger_wait(void);
 int trigger_check(char *);
 pid_t mcelog_fork(const char *thread_name);
+void dump_trigger_stats(FILE *f);
+void trigger_env_start(void);
+void trigger_env_add(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void trigger_env_add_saved(const char *block, size_t len);
+char *trigger_env_save(size_t *len);
+char **trigger_env_finish(void);
 
 #endif
@@ -116,8 +116,10 @@ static void tulsa_decode_internal(u64 status)
 		decode_bitfield(mca, tls_uecc);
 }
 
-void tulsa_decode_model(u64 status, u64 misc)
+void tulsa_decode_model(int cputype, struct mce *m)
 {
+	u64 status = m->status, misc = m->misc;
+
 	decode_numfield(status, corr_numbers);
 	if (status & (1ULL << 52))
 		decode_numfield(status, ecc_numbers);
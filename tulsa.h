@@ -1 +1 @@
-void tulsa_decode_model(u64 status, u64 misc);
+void tulsa_decode_model(int cputype, struct mce *m);
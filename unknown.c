@@ -16,7 +16,6 @@
    on your Linux system. */
 #define _GNU_SOURCE 1
 #include <stdio.h>
-#include <assert.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -28,10 +27,6 @@
 
 static char *unknown_trigger;
 
-enum {
-	MAX_ENV = 20,
-};
-
 void unknown_setup(void)
 {
 	unknown_trigger = config_string("socket", "unknown-threshold-trigger");
@@ -44,42 +39,28 @@ void unknown_setup(void)
 
 void run_unknown_trigger(int socket, int cpu, struct mce *log)
 {
-	int ei = 0;
-	char *env[MAX_ENV];
-	int i;
-	char *msg;
-	char *location;
+	char location[64];
 
 	if (!unknown_trigger)
 		return;
 
 	if (socket >= 0)
-		xasprintf(&location, "CPU %d on socket %d", cpu, socket);
+		snprintf(location, sizeof(location), "CPU %d on socket %d", cpu, socket);
 	else
-		xasprintf(&location, "CPU %d", cpu);
-	xasprintf(&msg, "%s received unknown error", location);
-	xasprintf(&env[ei++], "LOCATION=%s", location);
-	free(location);
-	location = NULL;
+		snprintf(location, sizeof(location), "CPU %d", cpu);
+	trigger_env_start();
+	trigger_env_add("LOCATION=%s", location);
 
 	if (socket >= 0)
-		xasprintf(&env[ei++], "SOCKETID=%d", socket);
-	xasprintf(&env[ei++], "MESSAGE=%s", msg);
-	xasprintf(&env[ei++], "CPU=%d", cpu);
-	xasprintf(&env[ei++], "STATUS=%llx", log->status);
-	xasprintf(&env[ei++], "MISC=%llx", log->misc);
-	xasprintf(&env[ei++], "ADDR=%llx", log->addr);
-	xasprintf(&env[ei++], "MCGSTATUS=%llx", log->mcgstatus);
-	xasprintf(&env[ei++], "MCGCAP=%llx", log->mcgcap);
-	env[ei] = NULL;
-	assert(ei < MAX_ENV);
+		trigger_env_add("SOCKETID=%d", socket);
+	trigger_env_add("MESSAGE=%s received unknown error", location);
+	trigger_env_add("CPU=%d", cpu);
+	trigger_env_add("STATUS=%llx", log->status);
+	trigger_env_add("MISC=%llx", log->misc);
+	trigger_env_add("ADDR=%llx", log->addr);
+	trigger_env_add("MCGSTATUS=%llx", log->mcgstatus);
+	trigger_env_add("MCGCAP=%llx", log->mcgcap);
 
-	run_trigger(unknown_trigger, NULL, env, false, "unknown");
-	for (i = 0; i < ei; i++) {
-		free(env[i]);
-		env[i] = NULL;
-	}
-	free(msg);
-	msg = NULL;
+	run_trigger(unknown_trigger, NULL, trigger_env_finish(), false, "unknown");
 }
 
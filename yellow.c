@@ -17,7 +17,6 @@
    Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA */
 #define _GNU_SOURCE 1
 #include <stdio.h>
-#include <assert.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -34,10 +33,6 @@
 static char *yellow_trigger;
 static int yellow_log = 1;
 
-enum {
-	MAX_ENV = 10,
-};
-
 static char *cpulist(char *prefix, unsigned *cpumask, unsigned cpumasklen)
 {
 	unsigned i, k;
@@ -60,11 +55,8 @@ static char *cpulist(char *prefix, unsigned *cpumask, unsigned cpumasklen)
 
 void run_yellow_trigger(int cpu, int tnum, int lnum, char *ts, char *ls, int socket)
 {
-	int ei = 0;
-	char *env[MAX_ENV];
 	unsigned *cpumask;
 	int cpumasklen;
-	int i;
 	char *msg;
 	char *location;
 
@@ -83,24 +75,22 @@ void run_yellow_trigger(int cpu, int tnum, int lnum, char *ts, char *ls, int soc
 	if (!yellow_trigger)
 		goto out;
 
+	trigger_env_start();
 	if (socket >= 0)
-		xasprintf(&env[ei++], "SOCKETID=%d", socket);
-	xasprintf(&env[ei++], "MESSAGE=%s", msg);
-	xasprintf(&env[ei++], "CPU=%d", cpu);
-	xasprintf(&env[ei++], "LEVEL=%d", lnum);
-	xasprintf(&env[ei++], "TYPE=%s", ts);
-	if (cache_to_cpus(cpu, lnum, tnum, &cpumasklen, &cpumask) >= 0)
-		env[ei++] = cpulist("AFFECTED_CPUS=", cpumask, cpumasklen); 
-	else
-		xasprintf(&env[ei++], "AFFECTED_CPUS=unknown");
-	env[ei] = NULL;	
-	assert(ei < MAX_ENV);
+		trigger_env_add("SOCKETID=%d", socket);
+	trigger_env_add("MESSAGE=%s", msg);
+	trigger_env_add("CPU=%d", cpu);
+	trigger_env_add("LEVEL=%d", lnum);
+	trigger_env_add("TYPE=%s", ts);
+	if (cache_to_cpus(cpu, lnum, tnum, &cpumasklen, &cpumask) >= 0) {
+		char *cpus = cpulist("AFFECTED_CPUS=", cpumask, cpumasklen); 
 
-	run_trigger(yellow_trigger, NULL, env, false, "yellow");
-	for (i = 0; i < ei; i++) {
-		free(env[i]);
-		env[i] = NULL;
-	}
+		trigger_env_add("%s", cpus);
+		free(cpus);
+	} else
+		trigger_env_add("AFFECTED_CPUS=unknown");
+
+	run_trigger(yellow_trigger, NULL, trigger_env_finish(), false, "yellow");
 out:
 	free(msg);
 	msg = NULL;